@@ -13,8 +13,36 @@
 **				enter the "time" command to get the system time during
 **				gameplay, which utilizes a separate thread to return the
 **				system time (blocking the main thread while doing so).
+**				The time thread is started once and also records each
+**				time in currentTime.txt (unless --no-time-file is given).
+**
+**				If the newest rooms directory holds a binary maze file
+**				(see fridkisb.maze.h), it is memory-mapped and used in
+**				place instead of reading room files. A maze file can also
+**				be given directly with --maze <file>, or streamed on a
+**				file descriptor with --maze-fd N (see streamMaze()).
+**				With --page-cache N, the file's rooms are instead read in
+**				shards as they are reached and kept in a bounded LRU
+**				cache (see pageMaze()).
+**
+**				With --server <socket>, the maze is loaded once and
+**				served to any number of players over a Unix domain
+**				socket (see serve() and fridkisb.loadgen.c), and with
+**				--watch each newly generated maze is loaded in the
+**				background and served to new players (see watchMazes()).
+**				With --script <file>, scripted sessions are played
+**				headless (see replay()).
+**
+**				With --simulate N, N random (or --policy greedy) players
+**				are walked through the maze on every thread and the
+**				distribution of their steps is printed (see simulate()).
+**
+**				The "save" and "resume" commands (and --resume <file>)
+**				write and restore checkpoint files of a game in progress
+**				(see writeCheckpoint()).
 ****************************************************************************/
 
+#define _GNU_SOURCE
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -26,381 +54,4811 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include "fridkisb.maze.h"
 
-//The following typedef and 3 functions are used to create
-//a dynamic array of strings. The code is relies heavily on this post:
-//https://stackoverflow.com/questions/3536153/c-dynamically-growing-array
+//Number of per-move latency histogram buckets; bucket k counts moves
+//taking 2^k to 2^(k+1) nanoseconds.
+#define STATS_BUCKETS 40
+
+//Instrumentation enabled with --stats (see printStats()). Counters are
+//only updated when enabled is set, so with --stats off each costs a
+//single branch. They are shared by the loader, server and replay
+//threads, so they are updated atomically.
 typedef struct {
-	char** path;
-	size_t used;
-	size_t size;
+	int enabled;
+	double discover;			//Phase times, in seconds
+	double load;
+	double validate;			//Part of load spent in validateMaze()
+	double play;
+	double timeThread;			//Time spent answering "time"
+	uint64_t syscalls;			//System calls made directly by the game
+	uint64_t bytesRead;
+	uint64_t allocations;
+	uint64_t moves;
+	uint64_t invalidInputs;
+	uint64_t hints;
+	uint64_t timeRequests;
+	uint64_t shardLoads;		//Shards read by a paged maze (see getShard())
+	uint64_t shardHits;			//Lookups answered from the shard cache
+	uint64_t latency[STATS_BUCKETS];
+} Stats;
+
+static Stats stats;
+
+//Function to add n to a counter, if stats are enabled.
+static inline void countStat(uint64_t* counter, uint64_t n){
+	if(stats.enabled){
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+	}
+}
+
+//Function to return the current time of the monotonic clock in seconds.
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Function to count one move taking the given number of seconds in
+//the latency histogram.
+void recordLatency(double seconds){
+	uint64_t ns = (uint64_t)(seconds * 1e9);
+	int k = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+	if(k >= STATS_BUCKETS){
+		k = STATS_BUCKETS - 1;
+	}
+	countStat(&stats.latency[k], 1);
+}
+
+//Function to print the stats, one "name value" line each, to the file
+//fileName (or stderr if it is NULL). Each non-empty latency bucket is
+//a "move_latency_ns <from> <to> <moves>" line.
+void printStats(const char* fileName){
+	
+	FILE* out = stderr;
+	if(fileName != NULL && (out = fopen(fileName, "w")) == NULL){
+		perror(fileName);
+		return;
+	}
+	fprintf(out, "discover_ms %.3f\n" "load_ms %.3f\n" "validate_ms %.3f\n" "play_ms %.3f\n" 
+		"time_thread_ms %.3f\n", stats.discover * 1e3, stats.load * 1e3, stats.validate * 1e3, 
+		stats.play * 1e3, stats.timeThread * 1e3);
+	fprintf(out, "syscalls %lu\n" "bytes_read %lu\n" "allocations %lu\n" "moves %lu\n"
+		"invalid_inputs %lu\n" "hints %lu\n" "time_requests %lu\n" "shard_loads %lu\n"
+		"shard_hits %lu\n", (unsigned long)stats.syscalls, (unsigned long)stats.bytesRead, 
+		(unsigned long)stats.allocations, (unsigned long)stats.moves, 
+		(unsigned long)stats.invalidInputs, (unsigned long)stats.hints, 
+		(unsigned long)stats.timeRequests, (unsigned long)stats.shardLoads, 
+		(unsigned long)stats.shardHits);
+	int k;
+	for(k = 0; k < STATS_BUCKETS; k++){
+		if(stats.latency[k] > 0){
+			fprintf(out, "move_latency_ns %lu %lu %lu\n", 1UL << k, 1UL << (k + 1), 
+				(unsigned long)stats.latency[k]);
+		}
+	}
+	if(out != stderr){
+		fclose(out);
+	}
+}
+
+//The following typedef and functions keep the player's path as a log
+//of room IDs (4 bytes per step). IDs are appended to one array that
+//grows by doubling (see https://stackoverflow.com/questions/3536153/c-dynamically-growing-array),
+//so a path costs a handful of allocations and a single free.
+//If pathSpillLimit is set, an array holding that many IDs is instead
+//appended to an (unlinked) temporary file, with each ID encoded as a
+//varint of its difference from the one before, and then reused; memory
+//use and allocations then stay flat however long the session runs.
+typedef struct {
+	uint32_t* rooms;			//IDs not (yet) spilled
+	size_t used;				//Entries in rooms
+	size_t size;				//Capacity of rooms
+	size_t spilled;				//Entries in the spill file
+	int spillFd;				//Spill file (or -1)
+	uint32_t last;				//Last ID spilled (deltas start from 0)
 } Path;
 
-void initPath(Path* p, size_t initSize, size_t wordSize) {
+//IDs kept in memory per path before spilling (0 never spills).
+static size_t pathSpillLimit = 0;
+
+void initPath(Path* p, size_t initSize){
 	
-	if((p->path = (char**)malloc(initSize * sizeof(char*))) == NULL){
+	if((p->rooms = malloc(initSize * sizeof(uint32_t))) == NULL){
 		perror("Error allocating memory for dynamic array");
 		exit(EXIT_FAILURE);
 	}
-	int i;
-	for(i = 0; i < (int)initSize; i++){
-		if(((p->path)[i] = malloc((wordSize + 1) * sizeof(char))) == NULL){
-			perror("Error allocating memory for dynamic array");
+	countStat(&stats.allocations, 1);
+	p->used = 0;
+	p->size = initSize;
+	p->spilled = 0;
+	p->spillFd = -1;
+	p->last = 0;
+}
+
+//Function to append the IDs held in memory to the path's spill file
+//(creating it first if need be) and empty the array.
+void spillPath(Path* p){
+	
+	if(p->spillFd == -1){
+		const char* dir = getenv("TMPDIR");
+		char fileName[4096];
+		snprintf(fileName, sizeof(fileName), "%s/fridkisb.path.XXXXXX", 
+			dir != NULL ? dir : "/tmp");
+		if((p->spillFd = mkstemp(fileName)) == -1){
+			perror("Error creating path spill file");
 			exit(EXIT_FAILURE);
 		}
+		unlink(fileName);
+	}
+
+	//Zigzag-encode each difference (so small steps either way stay
+	//small), then write it 7 bits per byte, low bits first.
+	unsigned char block[65536];
+	size_t len = 0, i;
+	for(i = 0; i < p->used; i++){
+		int64_t delta = (int64_t)p->rooms[i] - (int64_t)p->last;
+		uint64_t v = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+		p->last = p->rooms[i];
+		while(v >= 0x80){
+			block[len++] = (unsigned char)(v | 0x80);
+			v >>= 7;
+		}
+		block[len++] = (unsigned char)v;
+		if(len > sizeof(block) - 10 || i == p->used - 1){
+			if(write(p->spillFd, block, len) != (ssize_t)len){
+				perror("Error writing path spill file");
+				exit(EXIT_FAILURE);
+			}
+			countStat(&stats.syscalls, 1);
+			len = 0;
+		}
 	}
+	p->spilled += p->used;
 	p->used = 0;
-	p->size = initSize;
 }
 
-void insertPath(Path* p, char* room, size_t wordSize){
+void insertPath(Path* p, uint32_t room){
 	
-	int i = (int)p->used;
 	if(p->used == p->size){
-		p->size *= 2;
-		if((p->path = (char**)realloc(p->path, p->size * sizeof(char*))) == NULL){
-			perror("Error allocating memory for dynamic array");
-			exit(EXIT_FAILURE);
+		if(pathSpillLimit > 0 && p->size >= pathSpillLimit){
+			spillPath(p);
 		}
-		for(i = (int)p->used; i < (int)p->size; i++){
-			if(((p->path)[i] = malloc((wordSize + 1) * sizeof(char))) == NULL){
+		else{
+			//(Growth stops at the spill limit, so at most that many
+			//IDs are ever held in memory.)
+			p->size *= 2;
+			if(pathSpillLimit > 0 && p->size > pathSpillLimit){
+				p->size = pathSpillLimit;
+			}
+			if((p->rooms = realloc(p->rooms, p->size * sizeof(uint32_t))) == NULL){
 				perror("Error allocating memory for dynamic array");
 				exit(EXIT_FAILURE);
 			}
+			countStat(&stats.allocations, 1);
+		}
+	}
+	p->rooms[p->used++] = room;
+}
+
+//Function to return the number of rooms in the path.
+size_t pathLength(const Path* p){
+	return p->spilled + p->used;
+}
+
+//Function to call visit(room, arg) for every room in the path, in
+//order: first those in the spill file (decoded a block at a time),
+//then those still in memory.
+void walkPath(const Path* p, void (*visit)(uint32_t, void*), void* arg){
+	
+	unsigned char block[65536];
+	off_t offset = 0;
+	size_t done = 0;
+	uint64_t v = 0;
+	int shift = 0;
+	uint32_t last = 0;
+	while(done < p->spilled){
+		ssize_t n = pread(p->spillFd, block, sizeof(block), offset);
+		if(n <= 0){
+			perror("Error reading path spill file");
+			exit(EXIT_FAILURE);
+		}
+		offset += n;
+		countStat(&stats.syscalls, 1);
+		countStat(&stats.bytesRead, n);
+		ssize_t k;
+		for(k = 0; k < n && done < p->spilled; k++){
+			v |= (uint64_t)(block[k] & 0x7F) << shift;
+			shift += 7;
+			if((block[k] & 0x80) == 0){
+				int64_t delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+				last = (uint32_t)((int64_t)last + delta);
+				visit(last, arg);
+				done++;
+				v = 0;
+				shift = 0;
+			}
 		}
 	}
-	strcpy((p->path)[(int)p->used], room);
-	p->used++;
+	size_t i;
+	for(i = 0; i < p->used; i++){
+		visit(p->rooms[i], arg);
+	}
 }
 
 void freePath(Path* p){
 	
-	int i;
-	for(i = 0; i < (int)p->size; i++){
-		free((p->path)[i]);
+	free(p->rooms);
+	if(p->spillFd != -1){
+		close(p->spillFd);
 	}
-	free(p->path);
-	p->path = NULL;
-	p->used = p->size = 0;
+	p->rooms = NULL;
+	p->spillFd = -1;
+	p->used = p->size = p->spilled = 0;
 }
 
-//Function to change the process's working directory to that
+//Function to find the newest rooms directory in the current
+//directory, returning its name (in a static buffer, empty if there is
+//none). This is normally named by the first line of the manifest
+//LATEST_FILE_NAME, which fridkisb.buildrooms rewrites after every
+//maze. If there is no usable manifest, fall back to the directory
 //which has been most recently modified with a given target prefix.
 //Relies heavily on https://oregonstate.instructure.com/courses/1692912/pages/2-dot-4-manipulating-directories
-void setDirectory(){
-	int newestDirTime = -1;							//Last modified timestamp of newest subdir examined
+const char* newestDirectory(){
 	char targetDirPrefix[16] = "fridkisb.rooms.";   //Target directory prefix
-	static char newestDirName[21];					//Holds name of newest directory with target prefix
+	static char newestDirName[256];					//Holds name of newest directory with target prefix
+	struct stat dirAttributes;						//Holds information about the subdir/file (fileInDir)
+
+	//Read the directory name from the manifest.
+	int fd;
+	if((fd = open(LATEST_FILE_NAME, O_RDONLY)) != -1){
+		ssize_t n = read(fd, newestDirName, sizeof(newestDirName) - 1);
+		close(fd);
+		countStat(&stats.syscalls, 3);
+		countStat(&stats.bytesRead, n > 0 ? n : 0);
+		char* eol;
+		if(n > 0){
+			newestDirName[n] = '\0';
+			if((eol = strchr(newestDirName, '\n')) != NULL){
+				*eol = '\0';
+				countStat(&stats.syscalls, 1);
+				if(strncmp(newestDirName, targetDirPrefix, strlen(targetDirPrefix)) == 0 &&
+				   strchr(newestDirName, '/') == NULL && stat(newestDirName, &dirAttributes) == 0 &&
+				   S_ISDIR(dirAttributes.st_mode)){
+					return newestDirName;
+				}
+			}
+		}
+	}
 
+	struct timespec newestDirTime = {-1, 0};			//Last modified timestamp of newest subdir examined
 	DIR* dirToCheck;								//Holds starting directory
 	struct dirent* fileInDir;						//Holds the current subdir/file of starting directory
-	struct stat dirAttributes;						//Holds information about the subdir/file (fileInDir)
 
+	memset(newestDirName, '\0', sizeof(newestDirName));
 	dirToCheck = opendir(".");						//Open current directory (i.e. directory from which
 													//the program was executed
 	
-	if (dirToCheck > 0){							//Make sure directory was successfully opened
+	if (dirToCheck != NULL){						//Make sure directory was successfully opened
 		while((fileInDir = readdir(dirToCheck)) != NULL){
-			if(strstr(fileInDir->d_name, targetDirPrefix) != NULL){
-				stat(fileInDir->d_name, &dirAttributes);				//If directory entry contains target prefix, 
-																		//get stats (i.e. store in dirAttributes)
-
-				if((int)dirAttributes.st_mtime > newestDirTime){		//If the directory is newer than the previously
-					newestDirTime = (int)dirAttributes.st_mtime;		//determined newest, update newest.
-					memset(newestDirName, '\0', sizeof(newestDirName));
-					strcpy(newestDirName, fileInDir->d_name);
-				}
+			//Only directories with the target prefix are examined, and
+			//only they are stat'ed (relative to the open directory).
+			if(strncmp(fileInDir->d_name, targetDirPrefix, strlen(targetDirPrefix)) != 0 ||
+			   (fileInDir->d_type != DT_DIR && fileInDir->d_type != DT_UNKNOWN)){
+				continue;
+			}
+			countStat(&stats.syscalls, 1);
+			if(fstatat(dirfd(dirToCheck), fileInDir->d_name, &dirAttributes, 
+					AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(dirAttributes.st_mode)){
+				continue;
+			}
+
+			//If the directory is newer than the previously determined
+			//newest, update newest.
+			if(dirAttributes.st_mtim.tv_sec > newestDirTime.tv_sec ||
+			   (dirAttributes.st_mtim.tv_sec == newestDirTime.tv_sec && 
+			    dirAttributes.st_mtim.tv_nsec > newestDirTime.tv_nsec)){
+				newestDirTime = dirAttributes.st_mtim;
+				snprintf(newestDirName, sizeof(newestDirName), "%s", fileInDir->d_name);
 			}
 		}
+
+		//Close directory opened
+		closedir(dirToCheck);						
 	}
-	
-	//Close directory opened
-	closedir(dirToCheck);						
 
-	//Navigate process to the newest rooms directory
-	chdir(newestDirName);
+	return newestDirName;
 }
 
+//Function to change the process's working directory to the newest
+//rooms directory (see newestDirectory()).
+void setDirectory(){
+	chdir(newestDirectory());
+	countStat(&stats.syscalls, 1);
+}
+
+//Marks an unused slot in a NameIndex, or a name with no room.
+#define NO_ROOM UINT32_MAX
+
+//Perfect hash index from room names to room IDs, built at load time
+//(see buildNameIndex()). Each name hashes to a bucket, and each bucket
+//has a displacement chosen so that all of its names land in distinct
+//slots not used by any other bucket. A lookup is then one hash, two
+//array reads and one name comparison, whatever the size of the maze.
 typedef struct {
-	char name[9];
-	char connections[6][9];
-	char type;
-	int numConnections;
-} Room;
+	uint64_t seed;
+	uint32_t numBuckets;
+	uint32_t numSlots;
+	const uint32_t* displace;	//Displacement of each bucket
+	const uint32_t* slots;		//Room ID in each slot (or NO_ROOM)
+} NameIndex;
 
-Room* loadRooms(){
-	
-	DIR* roomDIR;
-	if((roomDIR = opendir(".")) <= 0){
-		perror("Room directory could not be opened.");
-		exit(EXIT_FAILURE);
+//A range of rooms of a paged maze (see getShard()): the slices of
+//the maze file's sections for rooms first to first + numRooms - 1,
+//with adjIndex and nameIndex made relative to the slices.
+typedef struct {
+	uint32_t shard;				//Shard number (or NO_ROOM if the slot is empty)
+	uint32_t first;				//ID of the first room held
+	uint32_t numRooms;
+	uint32_t newer;				//Neighbouring slots in the pager's LRU list
+	uint32_t older;
+	uint32_t* nameIndex;		//numRooms + 1 entries
+	uint32_t* adjIndex;			//numRooms + 1 entries
+	uint32_t* adj;
+	char* strings;
+	size_t adjSize;				//Capacities of adj and strings
+	size_t stringsSize;
+} Shard;
+
+//Rooms of a maze file read on demand instead of mapped in whole
+//(--page-cache). The rooms are split into shards of shardRooms
+//consecutive IDs, and at most numSlots shards are held at a time;
+//when all are in use, the least recently used one is replaced. The
+//slots are kept in a list from most to least recently used, so hits
+//and replacements take constant time whatever the cache size. The
+//shard whose connections were looked up last is never replaced, so
+//a room's connections stay valid while their names are looked up.
+//A pager is not thread safe, so a paged maze is played on one thread.
+//A shard that cannot be read (or is corrupt) is reported and counted
+//in errors, and its rooms have no name and no connections; whoever
+//was using the maze checks mazeErrors() and gives up on what it was
+//doing, rather than the whole program stopping.
+typedef struct {
+	int fd;
+	MazeHeader header;
+	uint32_t shardRooms;
+	uint32_t numShards;
+	uint32_t* slotOf;			//Slot holding each shard (or NO_ROOM)
+	Shard* slots;
+	uint32_t numSlots;
+	uint32_t pinned;			//Slot of the last connections looked up
+	uint32_t newest;			//Ends of the LRU list
+	uint32_t oldest;
+	int prefetch;				//Whether to ask the kernel to read ahead
+	uint32_t errors;			//Shards that could not be read (see mazeErrors())
+} Pager;
+
+//In-memory maze used by the game loop. Rooms are identified by integer
+//IDs, and the connections of room i are adj[adjIndex[i]] through
+//adj[adjIndex[i + 1] - 1]. The arrays either point directly into a
+//memory-mapped maze file (see mapMaze()), into a single block built
+//from the room files (see loadRooms()), or at a maze compiled into
+//the program (see loadBuiltin()). A paged maze (see pageMaze()) has
+//none of them: its rooms are only reached through roomName() and
+//roomLinks(), which read them into a shard cache as needed.
+typedef struct {
+	uint32_t numRooms;
+	uint32_t startRoom;
+	uint32_t endRoom;
+	const uint32_t* nameIndex;
+	const uint32_t* adjIndex;
+	const uint32_t* adj;
+	const char* strings;
+	NameIndex index;			//Finds room IDs by name (see findRoom())
+	void* block;				//Block allocated by loadRooms() (or NULL)
+	void* map;					//Mapping created by mapMaze() (or NULL)
+	size_t mapSize;
+	int builtin;				//Whether everything is compiled in (nothing to free)
+	uint64_t checksum;			//Identifies the maze in checkpoints (see mazeChecksum())
+	int haveChecksum;			//Whether checksum has been computed yet
+	Pager* pager;				//Shard cache of a paged maze (or NULL)
+} Maze;
+
+Shard* getShard(Pager* p, uint32_t room);
+
+//Function to return the name of room id. The name of a paged room
+//stays valid until another room is looked up.
+const char* roomName(const Maze* m, uint32_t id){
+	if(m->pager != NULL){
+		Shard* sh = getShard(m->pager, id);
+		return sh != NULL ? sh->strings + sh->nameIndex[id - sh->first] : "";
 	}
-	struct dirent* fileInDir;
+	return m->strings + m->nameIndex[id];
+}
 
-	static Room rooms[7];
-	int i;
-	for(i = 0; i < 7; i++){
-		//Determine name of next file in directory and open
-		//(Skip hidden files and "." and ".." directory files!)
-		do{
-			fileInDir = readdir(roomDIR);
-		}while(fileInDir->d_name[0] ==  '.');
-		FILE* fp;
-		if((fp = fopen((char*)fileInDir->d_name, "r")) == NULL){
-			printf("Error opening %s\n", fileInDir->d_name);
-			exit(EXIT_FAILURE);
-		}
-		
-		int c, cc = 0;
-	
-		//Determine connection count by counting newlines,
-		//then subtracting 1 (as first newline is for room name).
-		while((c = fgetc(fp)) != EOF){
-			if(c == '\n'){
-				cc++;
-			}
+//Function to return the connections of room id, storing their number
+//in *degree. The connections of a paged room stay valid until the
+//connections of another room are looked up.
+const uint32_t* roomLinks(const Maze* m, uint32_t id, uint32_t* degree){
+	if(m->pager != NULL){
+		Pager* p = m->pager;
+		Shard* sh = getShard(p, id);
+		if(sh == NULL){
+			static const uint32_t noLinks[1];
+			*degree = 0;
+			return noLinks;
 		}
+		p->pinned = (uint32_t)(sh - p->slots);
+		*degree = sh->adjIndex[id - sh->first + 1] - sh->adjIndex[id - sh->first];
+		return sh->adj + sh->adjIndex[id - sh->first];
+	}
+	*degree = m->adjIndex[id + 1] - m->adjIndex[id];
+	return m->adj + m->adjIndex[id];
+}
 
-		rooms[i].numConnections = cc - 1;
+//Function to return the number of times a shard of maze m could not
+//be read (always 0 unless the maze is paged). Comparing it before and
+//after using the maze tells whether the rooms seen were all real.
+uint32_t mazeErrors(const Maze* m){
+	return m->pager != NULL ? m->pager->errors : 0;
+}
 
-		//Reset file pointer to start of room name
-		fseek(fp, 11L, SEEK_SET);
-		//Load name into Room struct
-		int d = 0;
-		memset(rooms[i].name, '\0', sizeof(rooms[i].name));
-		while((c = fgetc(fp)) != '\n'){
-			rooms[i].name[d++] = c;
-		}
-		
-		//Load each connection into Room struct
-		int j;
-		for(j = 0; j < rooms[i].numConnections; j++){
-			fseek(fp, 14L, SEEK_CUR);
-			d = 0;
-			memset(rooms[i].connections[j], '\0', sizeof(rooms[i].connections[j]));
-			while((c = fgetc(fp)) != '\n'){
-				rooms[i].connections[j][d++] = c;
-			}
-		}
-		
-		//Load room type into Room struct
-		fseek(fp, 11L, SEEK_CUR);
-		rooms[i].type = (char)fgetc(fp);
+//Function to return the number of (one-way) connections in maze m.
+uint32_t numConnections(const Maze* m){
+	return m->pager != NULL ? m->pager->header.numTargets : m->adjIndex[m->numRooms];
+}
 
-		fclose(fp);
+//Function to hash a room name (64 bit FNV-1a).
+uint64_t hashName(const char* name, uint64_t seed){
+	uint64_t h = 0xCBF29CE484222325ULL ^ seed;
+	while(*name != '\0'){
+		h ^= (unsigned char)*name++;
+		h *= 0x100000001B3ULL;
 	}
+	return h;
+}
 
-	//Close room directory
-	closedir(roomDIR);
+//Function to scramble a 64 bit value (murmur3 finalizer).
+uint64_t mix64(uint64_t x){
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	return x ^ (x >> 33);
+}
 
-	//Navigate back up a directory after loading the rooms
-	//into memory.
-	chdir("..");
+//Functions to map a name hash to its bucket, and (given the bucket's
+//displacement d) to its slot. Both scale a 32 bit hash into range
+//with a multiply instead of a division.
+uint32_t hashBucket(uint64_t h, uint32_t numBuckets){
+	return (uint32_t)(((mix64(h) & 0xFFFFFFFFULL) * numBuckets) >> 32);
+}
 
-	return rooms;
+uint32_t hashSlot(uint64_t h, uint32_t d, uint32_t numSlots){
+	return (uint32_t)(((mix64(h + (d + 1) * 0x9E3779B97F4A7C15ULL) >> 32) * numSlots) >> 32);
 }
 
-//Function to write current time to currentTime.txt file. 
-//Creates currentTime.txt file if it does not previously exist.
-void* writeTime(void* mutex){
+//Function to try to place every room in the index with the current
+//seed, filling in the index's displace and slots arrays. Returns 1 if
+//every room was placed, 0 if some bucket could not be (the caller then
+//retries with another seed), or -1 if a room is listed twice or memory
+//ran out.
+int placeNames(NameIndex* x, uint32_t* displace, uint32_t* slots, const Maze* m, 
+		const uint64_t* hashes){
 	
-	//The main thread will have this locked first, and will
-	//only unlock it when the user inputs the "time" command.
-	//This will ensure that this function's thread only executes when this
-	//command (i.e. the "time" command) is input. The main thread will
-	//"wait" for the thread running this function  via the use of pthread_join 
-	//and so it in turn will be blocked during its execution.
-	pthread_mutex_lock((pthread_mutex_t*)mutex);
+	uint32_t n = m->numRooms;
+	uint32_t numBuckets = x->numBuckets;
+	uint32_t* bucketStart = calloc((size_t)numBuckets + 1, sizeof(uint32_t));
+	uint32_t* keys = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* order = malloc((size_t)numBuckets * sizeof(uint32_t));
+	if(bucketStart == NULL || keys == NULL || order == NULL){
+		perror("Error allocating memory for name index");
+		free(bucketStart);
+		free(keys);
+		free(order);
+		return -1;
+	}
 
-	//Open file currentTime.text (and create, if necessary).
-	int fd;
-	if((fd = open("currentTime.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1){
-		perror("Error opening currentTime.txt");
-		exit(EXIT_FAILURE);
+	//Group room IDs by bucket (counting sort).
+	uint32_t i, b, maxSize = 0;
+	for(i = 0; i < n; i++){
+		bucketStart[hashBucket(hashes[i], numBuckets) + 1]++;
+	}
+	for(b = 0; b < numBuckets; b++){
+		if(bucketStart[b + 1] > maxSize){
+			maxSize = bucketStart[b + 1];
+		}
+		bucketStart[b + 1] += bucketStart[b];
+	}
+	uint32_t* fill = malloc(((size_t)numBuckets > maxSize + 1 ? numBuckets : maxSize + 1) 
+		* sizeof(uint32_t));
+	if(fill == NULL){
+		perror("Error allocating memory for name index");
+		free(bucketStart);
+		free(keys);
+		free(order);
+		return -1;
+	}
+	memcpy(fill, bucketStart, numBuckets * sizeof(uint32_t));
+	for(i = 0; i < n; i++){
+		keys[fill[hashBucket(hashes[i], numBuckets)]++] = i;
 	}
-	
-	//Get time and write to file in specified format.
-	time_t rawtime;
-	struct tm* timeinfo;
 
-	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+	//Order buckets from largest to smallest (another counting sort), as
+	//the big buckets are the hardest to place once the table fills up.
+	memset(fill, 0, (maxSize + 1) * sizeof(uint32_t));
+	for(b = 0; b < numBuckets; b++){
+		fill[maxSize - (bucketStart[b + 1] - bucketStart[b])]++;
+	}
+	uint32_t s, sum = 0;
+	for(s = 0; s <= maxSize; s++){
+		uint32_t count = fill[s];
+		fill[s] = sum;
+		sum += count;
+	}
+	for(b = 0; b < numBuckets; b++){
+		order[fill[maxSize - (bucketStart[b + 1] - bucketStart[b])]++] = b;
+	}
+
+	for(s = 0; s < x->numSlots; s++){
+		slots[s] = NO_ROOM;
+	}
 
-	char outputTime[41];
-	memset(outputTime, '\0', sizeof(outputTime));
+	int placed = 1;
+	for(i = 0; i < numBuckets && placed == 1; i++){
+		b = order[i];
+		uint32_t first = bucketStart[b], last = bucketStart[b + 1];
+		displace[b] = 0;
+		if(first == last){
+			continue;
+		}
 
-	strftime(outputTime, 41, "%I:%M%p, %A, %B %d, %Y", timeinfo);
+		//Names with equal hashes can never be separated: either the
+		//room is listed twice, or the seed has to change.
+		uint32_t j, k;
+		for(j = first; j < last && placed == 1; j++){
+			for(k = j + 1; k < last; k++){
+				if(hashes[keys[j]] == hashes[keys[k]]){
+					if(strcmp(roomName(m, keys[j]), roomName(m, keys[k])) == 0){
+						fprintf(stderr, "Duplicate room %s\n", roomName(m, keys[j]));
+						placed = -1;
+					}
+					else{
+						placed = 0;
+					}
+					break;
+				}
+			}
+		}
 
-	//Write each character of the datetime string (outputTime)
-	//until the null terminator is encountered.
-	int i = 0;
-	while(outputTime[i] != '\0'){
-		if((write(fd, outputTime + i++, 1) == -1)){
-			perror("Error writing to file currentTime.txt");
+		//Try displacements until every name in the bucket lands in a
+		//free slot, undoing partial placements along the way.
+		uint32_t d;
+		for(d = 0; placed == 1; d++){
+			if(d == (1U << 20)){
+				placed = 0;
+				break;
+			}
+			for(j = first; j < last; j++){
+				uint32_t slot = hashSlot(hashes[keys[j]], d, x->numSlots);
+				if(slots[slot] != NO_ROOM){
+					break;
+				}
+				slots[slot] = keys[j];
+			}
+			if(j == last){
+				displace[b] = d;
+				break;
+			}
+			for(k = first; k < j; k++){
+				slots[hashSlot(hashes[keys[k]], d, x->numSlots)] = NO_ROOM;
+			}
 		}
 	}
 
-	if((close(fd)) == -1){
-		perror("Error closing currentTime.txt");
+	free(bucketStart);
+	free(keys);
+	free(order);
+	free(fill);
+	return placed;
+}
+
+//Function to build the perfect hash index for maze m. hashes may hold
+//every room's name hashed with seed 0 (as computed by the loader
+//threads), or be NULL to have them computed here. Returns -1 (with
+//the index left empty) if a room is listed twice or memory ran out.
+int buildNameIndex(NameIndex* x, const Maze* m, const uint64_t* hashes){
+	
+	uint32_t n = m->numRooms;
+	x->numBuckets = n / 4 + 1;
+	x->numSlots = n + n / 4 + 1;
+	x->displace = x->slots = NULL;
+	uint32_t* displace = malloc((size_t)x->numBuckets * sizeof(uint32_t));
+	uint32_t* slots = malloc((size_t)x->numSlots * sizeof(uint32_t));
+	uint64_t* seeded = malloc((size_t)n * sizeof(uint64_t));
+	int placed = 0;
+	if(displace == NULL || slots == NULL || seeded == NULL){
+		perror("Error allocating memory for name index");
+		placed = -1;
 	}
 	
-	//Unlock the mutext
-	pthread_mutex_unlock((pthread_mutex_t*)mutex);
+	uint32_t i;
+	for(x->seed = 0; placed == 0; x->seed++){
+		if(hashes == NULL || x->seed > 0){
+			for(i = 0; i < n; i++){
+				seeded[i] = hashName(roomName(m, i), x->seed);
+			}
+			hashes = seeded;
+		}
+		if((placed = placeNames(x, displace, slots, m, hashes)) == 1){
+			break;
+		}
+	}
+	free(seeded);
+	if(placed == -1){
+		free(displace);
+		free(slots);
+		return -1;
+	}
+	x->displace = displace;
+	x->slots = slots;
+	return 0;
+}
 
-	return NULL;
+//Function to find a room ID by name. Returns NO_ROOM if there is
+//no such room.
+uint32_t findRoom(const Maze* m, const char* name){
+	const NameIndex* x = &m->index;
+	uint64_t h = hashName(name, x->seed);
+	uint32_t id = x->slots[hashSlot(h, x->displace[hashBucket(h, x->numBuckets)], x->numSlots)];
+	if(id != NO_ROOM && strcmp(name, roomName(m, id)) == 0){
+		return id;
+	}
+	return NO_ROOM;
 }
 
-int main(int argc, char* argv[]){
-	
-	//Navigate process to newest rooms directory 
-	setDirectory();
+//Function to free a name index.
+void freeNameIndex(NameIndex* x){
+	free((void*)x->displace);
+	free((void*)x->slots);
+	x->displace = x->slots = NULL;
+}
+
+//Whether loaded mazes are checked with validateMaze() (--no-validate
+//turns this off).
+static int validateMazes = 1;
 
-	//Load the contents of each room into memory
-	Room* rooms = loadRooms();
+//Most problems validateMaze() lists before giving up.
+#define MAX_PROBLEMS 20
+
+//Function to report a problem with the connection of room id at the
+//given position in its adjacency list. Locations are given as room
+//file and line if files (indexed by room ID, as in loadRooms()) is
+//set, otherwise by room name.
+void badConnection(const Maze* m, char** files, uint32_t id, uint32_t position, const char* problem){
+	uint32_t target = m->adj[m->adjIndex[id] + position];
+	if(files != NULL){
+		fprintf(stderr, "%s:%u: connection from %s to %s %s\n", files[id], position + 2, 
+			roomName(m, id), roomName(m, target), problem);
+	}
+	else{
+		fprintf(stderr, "room %s, connection %u: connection to %s %s\n", roomName(m, id), 
+			position + 1, roomName(m, target), problem);
+	}
+}
+
+//Function to check that every connection of maze m is to another
+//existing room, is listed only once, and has a matching connection
+//back. Rather than searching the other room's list for each one, the
+//connections are counting-sorted by target: the rooms connecting to x
+//come out in increasing order, and must be exactly x's own
+//connections, which a second counting sort puts in the same order.
+//That takes linear time and two extra arrays of IDs, so it stays on
+//even for million room mazes. Every problem found (up to
+//MAX_PROBLEMS) is reported, along with mazeName (its rooms directory
+//or file). Returns 0 if the maze is valid, otherwise -1.
+int validateMaze(const Maze* m, char** files, const char* mazeName){
 	
-	int cr = 0, er = 0;
+	double start = stats.enabled ? now() : 0;
+	uint32_t n = m->numRooms, i, k;
+	uint32_t numTargets = m->adjIndex[n];
+	uint32_t problems = 0;
 
-	//Establish starting room as current room (cr) and assign
-	//end room to er variable
-	int i;
-	for(i = 0; i < 7; i++){
-		if(rooms[i].type == 'S'){
-			cr = i;
+	//Check the adjacency index and targets before using them.
+	for(i = 0; i < n; i++){
+		if(m->adjIndex[i] > m->adjIndex[i + 1] || m->adjIndex[i + 1] > numTargets){
+			fprintf(stderr, "%s: room %s: bad adjacency index\n", mazeName, roomName(m, i));
+			return -1;
 		}
-		if(rooms[i].type == 'E'){
-			er = i;
+		for(k = m->adjIndex[i]; k < m->adjIndex[i + 1]; k++){
+			if(m->adj[k] >= n){
+				fprintf(stderr, "%s: room %s: connection %u is to room ID %u of %u\n", 
+					mazeName, roomName(m, i), k - m->adjIndex[i] + 1, m->adj[k], n);
+				return -1;
+			}
 		}
 	}
-	
-	
-	//Declare and initialize a dynamic array to hold series of room names,
-	//which will be used for the user's path.
-	//(Note this could have been implemented as an array of ints but I wanted
-	// some extra practice with memory allocation so opted for the slightly more
-	// complicated and memory intensive option of using a dynamic array of strings.)
-	Path* path = malloc(sizeof(Path));
-	initPath(path, 5, 8);
-	
-	//Use a mutex to block the thread (about to be created)
-	//until it is needed.
-	pthread_mutex_t lock;
-	if((pthread_mutex_init(&lock, NULL) != 0)){
-		perror("Failed to establish mutext");
-		exit(EXIT_FAILURE);
-	}
-	pthread_mutex_lock(&lock);		//Lock mutex until thread is needed! (see writeTime())
 
-	//Prompt user to navigate to a current room connection
-	//until user reaches end room!
-	while(cr != er){
-		
+	//revIndex/rev list, for each room, the rooms connecting to it.
+	uint32_t* revIndex = calloc((size_t)n + 1, sizeof(uint32_t));
+	uint32_t* rev = malloc(((size_t)numTargets + 1) * sizeof(uint32_t));
+	uint32_t* fill = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* sorted = malloc(((size_t)numTargets + 1) * sizeof(uint32_t));
+	if(revIndex == NULL || rev == NULL || fill == NULL || sorted == NULL){
+		perror("Error allocating memory for maze validation");
+		free(revIndex);
+		free(rev);
+		free(fill);
+		free(sorted);
+		return -1;
+	}
+	for(k = 0; k < numTargets; k++){
+		revIndex[m->adj[k] + 1]++;
+	}
+	for(i = 0; i < n; i++){
+		revIndex[i + 1] += revIndex[i];
+	}
+	memcpy(fill, revIndex, (size_t)n * sizeof(uint32_t));
+	for(i = 0; i < n; i++){
+		for(k = m->adjIndex[i]; k < m->adjIndex[i + 1]; k++){
+			rev[fill[m->adj[k]]++] = i;
+		}
+	}
 
-		printf("CURRENT LOCATION: %s\n"
-			   "POSSIBLE CONNECTIONS: ", rooms[cr].name);
-		for(i = 0; i < rooms[cr].numConnections; i++){
-			if(i != rooms[cr].numConnections - 1){
-				printf("%s ", rooms[cr].connections[i]);
+	//Sort each room's own connections by counting-sorting the
+	//reversed lists back again (a room may have any number of
+	//connections, so a per-room sort could be quadratic), then walk
+	//them alongside the rooms connecting back.
+	memcpy(fill, m->adjIndex, (size_t)n * sizeof(uint32_t));
+	for(i = 0; i < n; i++){
+		for(k = revIndex[i]; k < revIndex[i + 1]; k++){
+			sorted[fill[rev[k]]++] = i;
+		}
+	}
+	for(i = 0; i < n && problems < MAX_PROBLEMS; i++){
+		uint32_t first = m->adjIndex[i], last = m->adjIndex[i + 1];
+		uint32_t r = revIndex[i];
+		for(k = first; k < last && problems < MAX_PROBLEMS; k++){
+			uint32_t target = sorted[k];
+			while(r < revIndex[i + 1] && rev[r] < target){
+				r++;
+			}
+			int duplicate = k > first && sorted[k - 1] == target;
+			int noBack = r == revIndex[i + 1] || rev[r] != target;
+			if(target != i && !duplicate && !noBack){
+				continue;
+			}
+			//Find where the connection is listed (its second listing
+			//for a duplicate), for the report.
+			uint32_t position = first;
+			while(m->adj[position] != target){
+				position++;
+			}
+			if(duplicate){
+				do{
+					position++;
+				}while(m->adj[position] != target);
+			}
+			position -= first;
+			if(target == i){
+				badConnection(m, files, i, position, "is to the room itself");
+			}
+			else if(duplicate){
+				badConnection(m, files, i, position, "is listed twice");
 			}
 			else{
-				printf("%s.\n"
-					   "WHERE TO >", rooms[cr].connections[i]);
+				badConnection(m, files, i, position, "has no connection back");
 			}
+			problems++;
 		}
-	
-		//Get user input
-		char* input = NULL;					//Used for user input via getline function
-		size_t len = 0;						//Also used for getline function
-		getline(&input, &len, stdin);
-		//Strip trailing newline from user input
-		input[strlen(input) - 1] = '\0';
-
-		//Check for valid input
-		int stepTaken = 0;
-		for(i = 0; i < rooms[cr].numConnections; i++){
-			//If a valid connection was entered,
-			//determine connection room #, assign current room
-			//to room entered by user, and update steps taken
-			//and path array.
-			if(strcmp(input, rooms[cr].connections[i]) == 0){
-				int j;
-				for(j = 0; j < 7; j++){
-					if(strcmp(input, rooms[j].name) == 0){
-						insertPath(path, rooms[j].name, 8);	
-						cr = j;
-						stepTaken++;
-						printf("\n\n");
-						break;
-					}
-				}
-				break;
-			}
+	}
+
+	free(revIndex);
+	free(rev);
+	free(fill);
+	free(sorted);
+	if(problems > 0){
+		if(problems == MAX_PROBLEMS){
+			fprintf(stderr, "%s: maze is invalid (stopped after %d problems)\n", 
+				mazeName, MAX_PROBLEMS);
+		}
+		else{
+			fprintf(stderr, "%s: maze is invalid\n", mazeName);
+		}
+		return -1;
+	}
+	if(stats.enabled){
+		stats.validate += now() - start;
+	}
+	return 0;
+}
+
+//Number of room files handed to a loader thread at a time.
+#define LOAD_CHUNK 256
+
+//One parsed room file. The room name is stored in its chunk's pool,
+//immediately followed by the names of its connections.
+typedef struct {
+	size_t nameOffset;
+	uint32_t numConnections;
+	char type;
+} RoomRecord;
+
+//Rooms parsed from one chunk of (up to LOAD_CHUNK) room files, along
+//with where they land in the merged Maze. Chunks are numbered in
+//directory order, so room IDs do not depend on the number of threads.
+typedef struct {
+	char* pool;
+	size_t poolUsed;
+	size_t poolSize;
+	RoomRecord records[LOAD_CHUNK];
+	uint32_t numRecords;
+	uint32_t numTargets;
+	uint32_t firstRoom;			//ID of the chunk's first room
+	uint32_t firstTarget;		//Offset of its first connection in adj
+	size_t firstString;			//Offset of its first name in strings
+} RoomChunk;
+
+//State shared by the loader threads. Each phase of loadRooms() runs
+//on every thread, with threads claiming chunks from nextChunk until
+//none are left.
+typedef struct {
+	DIR* dir;					//Rooms directory (until parsed)
+	int dirFd;
+	int failed;					//Set when a room file cannot be loaded
+	char** files;
+	uint32_t numFiles;
+	RoomChunk* chunks;
+	uint32_t numChunks;
+	uint32_t nextChunk;
+	int phase;
+	Maze* maze;
+	uint32_t* nameIndex;
+	uint32_t* adjIndex;
+	uint32_t* adj;
+	char* strings;
+	uint64_t* hashes;			//Hash of each room name (seed 0)
+} Loader;
+
+enum { PARSE_PHASE, PLACE_PHASE, RESOLVE_PHASE };
+
+//Function to append a null-terminated copy of the first len
+//characters of str to a chunk's pool. Returns -1 if memory ran out.
+int appendPool(RoomChunk* chunk, const char* str, size_t len){
+	if(chunk->poolUsed + len + 1 > chunk->poolSize){
+		size_t size = (chunk->poolSize + len + 1) * 2;
+		char* pool;
+		if((pool = realloc(chunk->pool, size)) == NULL){
+			perror("Error allocating memory for rooms");
+			return -1;
 		}
-		//If user input is 'time', display system time using seperate thread.
-		//Existing/main thread is blocked via use of mutex. The secondary thread
-		//writes the system time to the file currentTime.txt, and then the main
-		//thread reads this information after it resumes execution.
-		if(!stepTaken && strcmp(input, "time") == 0){
+		chunk->pool = pool;
+		chunk->poolSize = size;
+		countStat(&stats.allocations, 1);
+	}
+	memcpy(chunk->pool + chunk->poolUsed, str, len);
+	chunk->pool[chunk->poolUsed + len] = '\0';
+	chunk->poolUsed += len + 1;
+	return 0;
+}
 
-			//Create a thread to be used for writeTime function, passing mutex as 
-			//argument. Thread is locked until main thread (i.e. calling thread, 
-			//or "this" thread) unlocks mutex below.
-			pthread_t tid;
-			if((pthread_create(&tid, NULL, writeTime, &lock)) != 0){
-				perror("Error creating thread");
-				exit(EXIT_FAILURE);
-			}
-		
-			//Unlocks mutex so tid (secondary thread that runs writeTime)
-			//can run.
-			pthread_mutex_unlock(&lock);
+//Function to report a problem with line lineNo of a room file.
+//Returns -1, for parseRoom() to pass on.
+int malformedRoom(const char* fileName, uint32_t lineNo, const char* problem){
+	fprintf(stderr, "%s:%u: malformed room file: %s\n", fileName, lineNo, problem);
+	return -1;
+}
 
-			//Wait until writeTime thread (tid) returns. (i.e. block the main
-			//thread until writeTime thread returns).
-			pthread_join(tid, NULL);
+//Function to read a room file and add its room to chunk. The file
+//(in the rooms directory dirFd) is read into *buf (grown as needed)
+//with a single pass of read() calls, then split into "ROOM NAME: ",
+//"CONNECTION <n>: " and "ROOM TYPE: " lines. Returns -1 (having
+//reported why) if the file cannot be read or is malformed.
+int parseRoom(int dirFd, const char* fileName, char** buf, size_t* bufSize, RoomChunk* chunk){
+	
+	int fd;
+	if((fd = openat(dirFd, fileName, O_RDONLY)) == -1){
+		perror(fileName);
+		return -1;
+	}
+	size_t len = 0;
+	ssize_t n;
+	do{
+		if(len == *bufSize){
+			size_t size = *bufSize ? *bufSize * 2 : 4096;
+			char* grown;
+			if((grown = realloc(*buf, size)) == NULL){
+				perror("Error allocating memory for rooms");
+				close(fd);
+				return -1;
+			}
+			*buf = grown;
+			*bufSize = size;
+			countStat(&stats.allocations, 1);
+		}
+		n = read(fd, *buf + len, *bufSize - len);
+		if(n == -1){
+			perror(fileName);
+			close(fd);
+			return -1;
+		}
+		len += n;
+		countStat(&stats.syscalls, 1);
+	}while(n > 0);
+	close(fd);
+	countStat(&stats.syscalls, 2);
+	countStat(&stats.bytesRead, len);
 
-			//Relock the mutex
-			pthread_mutex_lock(&lock);
+	RoomRecord* record = &chunk->records[chunk->numRecords++];
+	record->nameOffset = chunk->poolUsed;
+	record->numConnections = 0;
+	record->type = '\0';
 
-			int fd;
-			if((fd = open("currentTime.txt", O_RDONLY)) == -1){
-				perror("Error opening currentTime.txt");
+	//A room file is a "ROOM NAME: " line, its "CONNECTION <n>: "
+	//lines (numbered from 1) and a final "ROOM TYPE: " line.
+	uint32_t lineNo = 0;
+	char* line = *buf;
+	char* end = *buf + len;
+	while(line < end){
+		lineNo++;
+		char* eol = memchr(line, '\n', end - line);
+		if(eol == NULL){
+			eol = end;
+		}
+		char* value = memchr(line, ':', eol - line);
+		if(value == NULL || value + 2 > eol || value[1] != ' '){
+			return malformedRoom(fileName, lineNo, "expected \"<field>: <value>\"");
+		}
+		value += 2;
+		if(value == eol){
+			return malformedRoom(fileName, lineNo, "empty value");
+		}
+		if(record->type != '\0'){
+			return malformedRoom(fileName, lineNo, "ROOM TYPE must be the last line");
+		}
+		if(lineNo == 1){
+			if(strncmp(line, "ROOM NAME: ", 11) != 0){
+				return malformedRoom(fileName, lineNo, "expected ROOM NAME");
 			}
-			char curTime[41];
-			memset(curTime, '\0', sizeof(curTime));
-			int i = 0, errorDetector = 0;
-			while((errorDetector = read(fd, curTime + i++, 1)) > 0){}
-			if(errorDetector < 0){
-				perror("Cannot read file currentTime.txt");
+			if(appendPool(chunk, value, eol - value) == -1){
+				return -1;
 			}
-			printf("\n\n  %s\n\n\n"
-				   "WHERE TO? >", curTime);
-			
 		}
-		//Else if input is not a valid room connection, print message to user
-		//accordingly.
-		else if(!stepTaken){
-			printf("\n\nHUH? I DON'T UNDERSTAND THAT ROOM. TRY AGAIN.\n\n\n");
+		else if(strncmp(line, "CONNECTION ", 11) == 0){
+			char* number;
+			if(strtoul(line + 11, &number, 10) != record->numConnections + 1 || number != value - 2){
+				return malformedRoom(fileName, lineNo, "connections must be numbered 1, 2, 3, ...");
+			}
+			if(appendPool(chunk, value, eol - value) == -1){
+				return -1;
+			}
+			record->numConnections++;
 		}
-		
-		//Free user input memory
-		free(input);
+		else if(strncmp(line, "ROOM TYPE: ", 11) == 0){
+			if((eol - value == 10 && strncmp(value, "START_ROOM", 10) == 0) ||
+			   (eol - value == 8 && strncmp(value, "END_ROOM", 8) == 0) ||
+			   (eol - value == 8 && strncmp(value, "MID_ROOM", 8) == 0)){
+				record->type = *value;
+			}
+			else{
+				return malformedRoom(fileName, lineNo, "ROOM TYPE must be START_ROOM, END_ROOM or MID_ROOM");
+			}
+		}
+		else{
+			return malformedRoom(fileName, lineNo, "expected CONNECTION or ROOM TYPE");
+		}
+		line = eol + 1;
 	}
-
-	//Print congratulations message and game stats (steps taken & path).
-	printf("YOU HAVE FOUND THE END ROOM. CONGRATULATIONS!\n"
-		   "YOU TOOK %d STEPS. YOUR PATH TO VICTORY WAS:\n", (int)path->used);
-	for(i = 0; i < path->used; i++){
-		printf("%s\n", path->path[i]);
+	if(lineNo == 0){
+		return malformedRoom(fileName, 1, "empty room file");
 	}
+	if(record->type == '\0'){
+		return malformedRoom(fileName, lineNo, "missing ROOM TYPE");
+	}
+	chunk->numTargets += record->numConnections;
+	return 0;
+}
 
-	//Free memory used to hold user's path.
-	freePath(path); 
-	free(path); 
+//Function run by every loader thread (including the main thread)
+//for each phase: claim chunks until none are left and process them.
+//A room file that cannot be loaded sets failed, and the threads then
+//stop claiming chunks.
+void* loaderWorker(void* arg){
+	
+	Loader* l = arg;
+	char* buf = NULL;
+	size_t bufSize = 0;
+	uint32_t c;
+	while(!__atomic_load_n(&l->failed, __ATOMIC_RELAXED) &&
+	      (c = __atomic_fetch_add(&l->nextChunk, 1, __ATOMIC_RELAXED)) < l->numChunks){
+		RoomChunk* chunk = &l->chunks[c];
+		uint32_t i, j;
+		if(l->phase == PARSE_PHASE){
+			//Parse this chunk's room files into its pool.
+			uint32_t last = (c + 1) * LOAD_CHUNK;
+			for(i = c * LOAD_CHUNK; i < last && i < l->numFiles; i++){
+				if(parseRoom(l->dirFd, l->files[i], &buf, &bufSize, chunk) == -1){
+					__atomic_store_n(&l->failed, 1, __ATOMIC_RELAXED);
+					break;
+				}
+			}
+		}
+		else if(l->phase == PLACE_PHASE){
+			//Copy room names into the maze's string table, hash them
+			//and fill in the adjacency index.
+			size_t s = chunk->firstString;
+			uint32_t t = chunk->firstTarget;
+			for(i = 0; i < chunk->numRecords; i++){
+				RoomRecord* r = &chunk->records[i];
+				const char* name = chunk->pool + r->nameOffset;
+				size_t len = strlen(name) + 1;
+				memcpy(l->strings + s, name, len);
+				l->nameIndex[chunk->firstRoom + i] = s;
+				l->hashes[chunk->firstRoom + i] = hashName(name, 0);
+				l->adjIndex[chunk->firstRoom + i] = t;
+				s += len;
+				t += r->numConnections;
+			}
+		}
+		else{
+			//Resolve connection names to room IDs.
+			uint32_t t = chunk->firstTarget;
+			for(i = 0; i < chunk->numRecords; i++){
+				RoomRecord* r = &chunk->records[i];
+				const char* name = chunk->pool + r->nameOffset;
+				const char* conn = name + strlen(name) + 1;
+				for(j = 0; j < r->numConnections; j++){
+					if((l->adj[t++] = findRoom(l->maze, conn)) == NO_ROOM){
+						fprintf(stderr, "%s:%u: room %s connects to unknown room %s\n", 
+							l->files[chunk->firstRoom + i], j + 2, name, conn);
+						__atomic_store_n(&l->failed, 1, __ATOMIC_RELAXED);
+						break;
+					}
+					conn += strlen(conn) + 1;
+				}
+			}
+		}
+	}
+	free(buf);
+	return NULL;
+}
 
-	//Kill the mutex
-	pthread_mutex_destroy(&lock);
+//Function to run one loader phase on numThreads threads. Returns -1
+//if it failed.
+int runPhase(Loader* l, int phase, int numThreads){
+	
+	l->phase = phase;
+	l->nextChunk = 0;
 
-	return 0;
+	pthread_t* tids;
+	if((tids = malloc(numThreads * sizeof(pthread_t))) == NULL){
+		perror("Error allocating memory for loader threads");
+		return -1;
+	}
+	int i, started;
+	for(started = 1; started < numThreads; started++){
+		if((pthread_create(&tids[started], NULL, loaderWorker, l)) != 0){
+			perror("Error creating thread");
+			l->failed = 1;
+			break;
+		}
+	}
+	loaderWorker(l);
+	for(i = 1; i < started; i++){
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	return l->failed ? -1 : 0;
+}
+
+//Function to free everything held by a loader, and, if m is not NULL
+//(when loadRooms() fails), the partly loaded maze.
+void freeLoader(Loader* l, Maze* m){
+	
+	if(l->dir != NULL){
+		closedir(l->dir);
+	}
+	free(l->hashes);
+	uint32_t i;
+	for(i = 0; l->chunks != NULL && i < l->numChunks; i++){
+		free(l->chunks[i].pool);
+	}
+	free(l->chunks);
+	for(i = 0; i < l->numFiles; i++){
+		free(l->files[i]);
+	}
+	free(l->files);
+	if(m != NULL){
+		free(m->block);
+		freeNameIndex(&m->index);
+		m->block = NULL;
+	}
+}
+
+//Function to load every room file in the directory dirName into m,
+//using numThreads threads (1 loads serially on the calling thread).
+//The room files are split into chunks which are parsed in parallel;
+//the chunks are then placed into a single block holding the Maze
+//arrays, room names are interned in the Maze's name index, and
+//connection names are resolved to room IDs. Returns -1 (having
+//reported why, and with nothing left allocated) if the maze cannot be
+//loaded.
+int loadRooms(Maze* m, const char* dirName, int numThreads){
+	
+	Loader l;
+	memset(&l, 0, sizeof(l));
+	m->block = NULL;
+	m->index.displace = m->index.slots = NULL;
+	if((l.dir = opendir(dirName)) == NULL){
+		perror("Room directory could not be opened.");
+		return -1;
+	}
+	struct dirent* fileInDir;
+
+	//List the room files (skip hidden files and "." and ".."
+	//directory files!)
+	l.dirFd = dirfd(l.dir);
+	uint32_t filesSize = 64;
+	if((l.files = malloc(filesSize * sizeof(char*))) == NULL){
+		perror("Error allocating memory for rooms");
+		freeLoader(&l, m);
+		return -1;
+	}
+	while((fileInDir = readdir(l.dir)) != NULL){
+		if(fileInDir->d_name[0] == '.'){
+			continue;
+		}
+		if(l.numFiles == filesSize){
+			char** files;
+			if((files = realloc(l.files, 2 * filesSize * sizeof(char*))) == NULL){
+				perror("Error allocating memory for rooms");
+				freeLoader(&l, m);
+				return -1;
+			}
+			l.files = files;
+			filesSize *= 2;
+		}
+		if((l.files[l.numFiles] = strdup(fileInDir->d_name)) == NULL){
+			perror("Error allocating memory for rooms");
+			freeLoader(&l, m);
+			return -1;
+		}
+		l.numFiles++;
+		countStat(&stats.allocations, 1);
+	}
+	if(l.numFiles == 0){
+		fprintf(stderr, "No room files found\n");
+		freeLoader(&l, m);
+		return -1;
+	}
+
+	l.numChunks = (l.numFiles + LOAD_CHUNK - 1) / LOAD_CHUNK;
+	if((l.chunks = calloc(l.numChunks, sizeof(RoomChunk))) == NULL){
+		perror("Error allocating memory for rooms");
+		freeLoader(&l, m);
+		return -1;
+	}
+	if(numThreads > (int)l.numChunks){
+		numThreads = l.numChunks;
+	}
+	if(runPhase(&l, PARSE_PHASE, numThreads) == -1){
+		freeLoader(&l, m);
+		return -1;
+	}
+	closedir(l.dir);
+	l.dir = NULL;
+
+	//Work out where each chunk's rooms, connections and names go.
+	uint32_t c, numRooms = 0, numTargets = 0;
+	size_t stringsSize = 0;
+	for(c = 0; c < l.numChunks; c++){
+		l.chunks[c].firstRoom = numRooms;
+		l.chunks[c].firstTarget = numTargets;
+		l.chunks[c].firstString = stringsSize;
+		numRooms += l.chunks[c].numRecords;
+		numTargets += l.chunks[c].numTargets;
+		uint32_t i;
+		for(i = 0; i < l.chunks[c].numRecords; i++){
+			stringsSize += strlen(l.chunks[c].pool + l.chunks[c].records[i].nameOffset) + 1;
+		}
+	}
+
+	//One block holds the name index, adjacency index, adjacency array
+	//and string table (in that order).
+	uint32_t* block;
+	if((block = malloc((2 * (size_t)numRooms + 1 + numTargets) * sizeof(uint32_t) + 
+			stringsSize)) == NULL){
+		perror("Error allocating memory for maze");
+		freeLoader(&l, m);
+		return -1;
+	}
+	m->block = block;
+	if((l.hashes = malloc(numRooms * sizeof(uint64_t))) == NULL){
+		perror("Error allocating memory for maze");
+		freeLoader(&l, m);
+		return -1;
+	}
+	countStat(&stats.allocations, 4);		//Files, chunks, block and hashes
+	l.maze = m;
+	l.nameIndex = block;
+	l.adjIndex = l.nameIndex + numRooms;
+	l.adj = l.adjIndex + numRooms + 1;
+	l.strings = (char*)(l.adj + numTargets);
+	l.adjIndex[numRooms] = numTargets;
+	m->numRooms = numRooms;
+	m->nameIndex = l.nameIndex;
+	m->adjIndex = l.adjIndex;
+	m->adj = l.adj;
+	m->strings = l.strings;
+	m->map = NULL;
+	m->pager = NULL;
+	m->mapSize = 0;
+	m->builtin = 0;
+	runPhase(&l, PLACE_PHASE, numThreads);
+
+	//Find the start and end rooms.
+	int haveStart = 0, haveEnd = 0;
+	for(c = 0; c < l.numChunks && !l.failed; c++){
+		uint32_t i;
+		for(i = 0; i < l.chunks[c].numRecords; i++){
+			uint32_t id = l.chunks[c].firstRoom + i;
+			if(l.chunks[c].records[i].type == 'S'){
+				if(haveStart){
+					fprintf(stderr, "%s: second START_ROOM (the first is in %s)\n", 
+						l.files[id], l.files[m->startRoom]);
+					l.failed = 1;
+					break;
+				}
+				m->startRoom = id;
+				haveStart = 1;
+			}
+			if(l.chunks[c].records[i].type == 'E'){
+				if(haveEnd){
+					fprintf(stderr, "%s: second END_ROOM (the first is in %s)\n", 
+						l.files[id], l.files[m->endRoom]);
+					l.failed = 1;
+					break;
+				}
+				m->endRoom = id;
+				haveEnd = 1;
+			}
+		}
+	}
+	if(!l.failed && (!haveStart || !haveEnd)){
+		fprintf(stderr, "Rooms directory has no START_ROOM or END_ROOM\n");
+		l.failed = 1;
+	}
+
+	//Intern the room names, then resolve connection names to IDs
+	//through the name index.
+	if(l.failed || buildNameIndex(&m->index, m, l.hashes) == -1 ||
+	   runPhase(&l, RESOLVE_PHASE, numThreads) == -1 ||
+	   (validateMazes && validateMaze(m, l.files, dirName) == -1)){
+		freeLoader(&l, m);
+		return -1;
+	}
+	freeLoader(&l, NULL);
+	return 0;
+}
+
+//Function to check that a section of len bytes at offset lies within
+//a maze file of size bytes, after the header. (Written so that no sum
+//can overflow, whatever the offset.)
+int sectionInFile(uint64_t offset, uint64_t len, uint64_t size){
+	return offset >= sizeof(MazeHeader) && offset <= size && len <= size - offset;
+}
+
+//Function to check the header of a binary maze file (fileName, size
+//bytes) before any of its sections are used. Returns -1 (having
+//reported it) if the header is not valid.
+int checkMazeHeader(const char* fileName, const MazeHeader* h, uint64_t size){
+	uint64_t n = h->numRooms;
+	if(size < sizeof(MazeHeader) ||
+	   memcmp(h->magic, MAZE_MAGIC, sizeof(h->magic)) != 0 || 
+	   h->version != MAZE_VERSION || h->fileSize != size || n == 0 ||
+	   h->startRoom >= n || h->endRoom >= n ||
+	   !sectionInFile(h->nameIndexOffset, n * sizeof(uint32_t), size) ||
+	   !sectionInFile(h->adjIndexOffset, (n + 1) * sizeof(uint32_t), size) ||
+	   !sectionInFile(h->adjOffset, (uint64_t)h->numTargets * sizeof(uint32_t), size) ||
+	   !sectionInFile(h->stringsOffset, h->stringsSize, size) ||
+	   ((h->nameIndexOffset | h->adjIndexOffset | h->adjOffset) & 3) != 0){
+		fprintf(stderr, "%s: not a valid version %d maze file\n", fileName, MAZE_VERSION);
+		return -1;
+	}
+	return 0;
+}
+
+//Sections of a binary maze file checked by checkMazeSection(). The
+//connections themselves are left to validateMaze().
+enum {NAME_SECTION, ADJ_INDEX_SECTION, STRINGS_SECTION, NUM_SECTIONS};
+
+//Function to return the offset just past a section of the maze file
+//with header h.
+uint64_t sectionEnd(const MazeHeader* h, int section){
+	switch(section){
+		case NAME_SECTION:
+			return h->nameIndexOffset + (uint64_t)h->numRooms * sizeof(uint32_t);
+		case ADJ_INDEX_SECTION:
+			return h->adjIndexOffset + ((uint64_t)h->numRooms + 1) * sizeof(uint32_t);
+		default:
+			return h->stringsOffset + h->stringsSize;
+	}
+}
+
+//Function to check one section of the binary maze file image at base
+//(its header already checked) against the header. Only that section
+//of the image needs to be present. Returns -1 (having reported it) if
+//the section is not valid.
+int checkMazeSection(const char* fileName, const char* base, int section){
+	
+	const MazeHeader* h = (const MazeHeader*)base;
+	uint32_t n = h->numRooms, i;
+	if(section == NAME_SECTION){
+		const uint32_t* nameIndex = (const uint32_t*)(base + h->nameIndexOffset);
+		for(i = 0; i < n; i++){
+			if(nameIndex[i] >= h->stringsSize){
+				fprintf(stderr, "%s: name of room ID %u is outside the file\n", fileName, i);
+				return -1;
+			}
+		}
+	}
+	else if(section == ADJ_INDEX_SECTION){
+		const uint32_t* adjIndex = (const uint32_t*)(base + h->adjIndexOffset);
+		if(adjIndex[n] != h->numTargets){
+			fprintf(stderr, "%s: adjacency index does not match header\n", fileName);
+			return -1;
+		}
+	}
+	else if(h->stringsSize == 0 || base[h->stringsOffset + h->stringsSize - 1] != '\0'){
+		fprintf(stderr, "%s: room names are not terminated\n", fileName);
+		return -1;
+	}
+	return 0;
+}
+
+//Function to point the Maze arrays into the binary maze file image at
+//base (its header and sections already checked) and index the room
+//names. Returns -1 (having reported why, naming fileName) if the image
+//cannot be used; the caller still owns base.
+int useMazeImage(const char* fileName, const char* base, Maze* m){
+	
+	const MazeHeader* h = (const MazeHeader*)base;
+	m->numRooms = h->numRooms;
+	m->startRoom = h->startRoom;
+	m->endRoom = h->endRoom;
+	m->nameIndex = (const uint32_t*)(base + h->nameIndexOffset);
+	m->adjIndex = (const uint32_t*)(base + h->adjIndexOffset);
+	m->adj = (const uint32_t*)(base + h->adjOffset);
+	m->strings = base + h->stringsOffset;
+	m->pager = NULL;
+	m->builtin = 0;
+
+	if(buildNameIndex(&m->index, m, NULL) == -1){
+		fprintf(stderr, "%s: room names could not be indexed\n", fileName);
+		return -1;
+	}
+	if(validateMazes && validateMaze(m, NULL, fileName) == -1){
+		freeNameIndex(&m->index);
+		return -1;
+	}
+	return 0;
+}
+
+//Function to memory-map a binary maze file (see fridkisb.maze.h) and
+//point the Maze arrays into the mapping. Only the header is checked;
+//the rest of the file is used in place and paged in on demand (apart
+//from the names, which are hashed into the name index). Returns -1
+//(having reported why) if the file cannot be used.
+int mapMaze(const char* fileName, Maze* m){
+	
+	int fd;
+	if((fd = open(fileName, O_RDONLY)) == -1){
+		perror(fileName);
+		return -1;
+	}
+	struct stat fileAttributes;
+	if(fstat(fd, &fileAttributes) == -1){
+		perror(fileName);
+		close(fd);
+		return -1;
+	}
+	size_t size = (size_t)fileAttributes.st_size;
+	if(size < sizeof(MazeHeader)){
+		fprintf(stderr, "%s: not a maze file\n", fileName);
+		close(fd);
+		return -1;
+	}
+	void* map;
+	if((map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+		perror(fileName);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	countStat(&stats.syscalls, 4);
+
+	//Check that the header is sane and every section lies within the file.
+	int section, result = checkMazeHeader(fileName, map, size);
+	for(section = 0; result == 0 && section < NUM_SECTIONS; section++){
+		result = checkMazeSection(fileName, map, section);
+	}
+	if(result == -1 || useMazeImage(fileName, map, m) == -1){
+		munmap(map, size);
+		return -1;
+	}
+	m->block = NULL;
+	m->map = map;
+	m->mapSize = size;
+	return 0;
+}
+
+//Function to read len bytes from the stream fd into buf. Returns -1
+//(having reported it) if the stream fails or ends first.
+int readStream(int fd, const char* name, char* buf, size_t len){
+	size_t done = 0;
+	while(done < len){
+		ssize_t n = read(fd, buf + done, len - done);
+		countStat(&stats.syscalls, 1);
+		if(n == -1 && errno == EINTR){
+			continue;
+		}
+		if(n == -1){
+			perror(name);
+			return -1;
+		}
+		if(n == 0){
+			fprintf(stderr, "%s: maze ended after %zu of %zu bytes\n", name, done, len);
+			return -1;
+		}
+		done += n;
+		countStat(&stats.bytesRead, n);
+	}
+	return 0;
+}
+
+//Function to read a binary maze streamed on the file descriptor fd
+//(such as a pipe from fridkisb.buildrooms --stdout) into m. The header
+//arrives first and is checked before anything else is read, and then
+//gives the size of the maze, so the rest is read straight into a
+//single block of exactly that size and used in place, as a mapped
+//maze file would be. Each section is checked as soon as it has
+//arrived, so a bad maze is rejected without reading the rest of it;
+//the room names come last, so they are indexed (and the maze
+//validated) once the whole maze is in. Nothing is written to disk,
+//and fd is closed. Returns -1 (having reported why) if no maze could
+//be read.
+int streamMaze(int fd, Maze* m){
+	
+	char name[32];
+	snprintf(name, sizeof(name), "maze fd %d", fd);
+	MazeHeader header;
+	if(readStream(fd, name, (char*)&header, sizeof(header)) == -1 ||
+	   checkMazeHeader(name, &header, header.fileSize) == -1){
+		close(fd);
+		return -1;
+	}
+
+	char* block;
+	if((block = malloc(header.fileSize)) == NULL){
+		perror("Error allocating memory for maze");
+		close(fd);
+		return -1;
+	}
+	countStat(&stats.allocations, 1);
+	memcpy(block, &header, sizeof(header));
+
+	//Read up to the end of the next section to arrive (in whatever
+	//order the file lays them out) and check it, until the sections
+	//are all checked and the file is read to its end.
+	int checked[NUM_SECTIONS] = {0};
+	uint64_t done = sizeof(header);
+	int result = 0;
+	while(result == 0){
+		uint64_t to = header.fileSize;
+		int next = -1, section;
+		for(section = 0; section < NUM_SECTIONS; section++){
+			if(!checked[section] && sectionEnd(&header, section) <= to){
+				to = sectionEnd(&header, section);
+				next = section;
+			}
+		}
+		if(to > done){
+			result = readStream(fd, name, block + done, to - done);
+			done = to;
+		}
+		if(next == -1){
+			break;
+		}
+		checked[next] = 1;
+		if(result == 0){
+			result = checkMazeSection(name, block, next);
+		}
+	}
+	close(fd);
+	if(result == -1 || useMazeImage(name, block, m) == -1){
+		free(block);
+		return -1;
+	}
+	m->block = block;
+	m->map = NULL;
+	m->mapSize = 0;
+	return 0;
+}
+
+//Function to read len bytes at offset of a paged maze's file into buf.
+//Returns -1 (having reported it) if they could not all be read.
+int readMaze(Pager* p, void* buf, size_t len, uint64_t offset){
+	size_t done = 0;
+	while(done < len){
+		ssize_t n = pread(p->fd, (char*)buf + done, len - done, offset + done);
+		if(n <= 0){
+			if(n == -1 && errno == EINTR){
+				continue;
+			}
+			if(n == 0){
+				fprintf(stderr, "Error reading maze file: it ends early\n");
+			}
+			else{
+				perror("Error reading maze file");
+			}
+			return -1;
+		}
+		done += n;
+		countStat(&stats.syscalls, 1);
+	}
+	countStat(&stats.bytesRead, len);
+	return 0;
+}
+
+//Function to grow *buf to hold at least len bytes. Returns -1 (having
+//reported it, and leaving *buf as it was) if memory ran out.
+int reserveShard(void** buf, size_t* size, size_t len){
+	if(*size < len){
+		size_t grown = len > 2 * *size ? len : 2 * *size;
+		void* data;
+		if((data = realloc(*buf, grown)) == NULL){
+			perror("Error allocating memory for shard");
+			return -1;
+		}
+		*buf = data;
+		*size = grown;
+		countStat(&stats.allocations, 1);
+	}
+	return 0;
+}
+
+//Function to read shard number shard into sh: its name and adjacency
+//index slices (one entry past the shard, to find where the last room
+//ends), then the connections and names they cover. Each shard is
+//checked as it is read, as a paged maze is never validated as a whole.
+//Returns -1 (having reported why) if the shard could not be read or
+//is not valid.
+int loadShard(Pager* p, Shard* sh, uint32_t shard){
+	
+	const MazeHeader* h = &p->header;
+	uint32_t first = shard * p->shardRooms;
+	uint32_t count = h->numRooms - first < p->shardRooms ? h->numRooms - first : p->shardRooms;
+	sh->shard = shard;
+	sh->first = first;
+	sh->numRooms = count;
+
+	//The name index has no entry past the last room; the strings end
+	//there instead.
+	uint32_t numNames = first + count < h->numRooms ? count + 1 : count;
+	if(readMaze(p, sh->nameIndex, numNames * sizeof(uint32_t), 
+		   h->nameIndexOffset + (uint64_t)first * sizeof(uint32_t)) == -1 ||
+	   readMaze(p, sh->adjIndex, (count + 1) * sizeof(uint32_t), 
+		   h->adjIndexOffset + (uint64_t)first * sizeof(uint32_t)) == -1){
+		return -1;
+	}
+	if(numNames == count){
+		sh->nameIndex[count] = h->stringsSize;
+	}
+
+	uint32_t i;
+	for(i = 0; i < count; i++){
+		if(sh->adjIndex[i] > sh->adjIndex[i + 1] || sh->adjIndex[i + 1] > h->numTargets ||
+		   sh->nameIndex[i] >= sh->nameIndex[i + 1] || sh->nameIndex[i + 1] > h->stringsSize){
+			fprintf(stderr, "Maze file cannot be paged: room ID %u is out of order\n", first + i);
+			return -1;
+		}
+	}
+	size_t numAdj = sh->adjIndex[count] - sh->adjIndex[0];
+	size_t numChars = sh->nameIndex[count] - sh->nameIndex[0];
+	if(reserveShard((void**)&sh->adj, &sh->adjSize, (numAdj + 1) * sizeof(uint32_t)) == -1 ||
+	   reserveShard((void**)&sh->strings, &sh->stringsSize, numChars) == -1 ||
+	   readMaze(p, sh->adj, numAdj * sizeof(uint32_t), 
+		   h->adjOffset + (uint64_t)sh->adjIndex[0] * sizeof(uint32_t)) == -1 ||
+	   readMaze(p, sh->strings, numChars, h->stringsOffset + sh->nameIndex[0]) == -1){
+		return -1;
+	}
+
+	for(i = 0; i < numAdj; i++){
+		if(sh->adj[i] >= h->numRooms){
+			fprintf(stderr, "Maze file: connection to room ID %u of %u\n", sh->adj[i], h->numRooms);
+			return -1;
+		}
+	}
+	countStat(&stats.shardLoads, 1);
+
+	//Ask the kernel to start reading the next shard (the rooms most
+	//likely to be reached from this one, as rooms are numbered
+	//breadth-first), guessing its size from the averages.
+	if(p->prefetch && first + count < h->numRooms){
+		uint64_t next = first + count;
+		posix_fadvise(p->fd, h->nameIndexOffset + next * sizeof(uint32_t), 
+			(off_t)p->shardRooms * sizeof(uint32_t), POSIX_FADV_WILLNEED);
+		posix_fadvise(p->fd, h->adjIndexOffset + next * sizeof(uint32_t), 
+			((off_t)p->shardRooms + 1) * sizeof(uint32_t), POSIX_FADV_WILLNEED);
+		posix_fadvise(p->fd, h->adjOffset + (uint64_t)sh->adjIndex[count] * sizeof(uint32_t), 
+			(off_t)((uint64_t)h->numTargets * p->shardRooms / h->numRooms + 1) * sizeof(uint32_t), 
+			POSIX_FADV_WILLNEED);
+		posix_fadvise(p->fd, h->stringsOffset + sh->nameIndex[count], 
+			(off_t)((uint64_t)h->stringsSize * p->shardRooms / h->numRooms + 1), 
+			POSIX_FADV_WILLNEED);
+		countStat(&stats.syscalls, 4);
+	}
+
+	for(i = count + 1; i-- > 0; ){
+		sh->adjIndex[i] -= sh->adjIndex[0];
+		sh->nameIndex[i] -= sh->nameIndex[0];
+	}
+	for(i = 0; i < count; i++){
+		if(sh->strings[sh->nameIndex[i + 1] - 1] != '\0'){
+			fprintf(stderr, "Maze file: name of room ID %u is not terminated\n", first + i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//Function to move slot to the front of the pager's LRU list.
+void touchSlot(Pager* p, uint32_t slot){
+	
+	if(p->newest == slot){
+		return;
+	}
+	Shard* sh = &p->slots[slot];
+	p->slots[sh->newer].older = sh->older;
+	if(sh->older != NO_ROOM){
+		p->slots[sh->older].newer = sh->newer;
+	}
+	else{
+		p->oldest = sh->newer;
+	}
+	sh->newer = NO_ROOM;
+	sh->older = p->newest;
+	p->slots[p->newest].newer = slot;
+	p->newest = slot;
+}
+
+//Function to return the shard holding room, reading it into the
+//least recently used slot (other than the pinned one) if it is not
+//already cached. Returns NULL (leaving the slot empty and counting
+//the error) if the shard could not be read.
+Shard* getShard(Pager* p, uint32_t room){
+	
+	uint32_t shard = room / p->shardRooms;
+	uint32_t slot = p->slotOf[shard];
+	if(slot != NO_ROOM){
+		touchSlot(p, slot);
+		countStat(&stats.shardHits, 1);
+		return &p->slots[slot];
+	}
+	slot = p->oldest != p->pinned ? p->oldest : p->slots[p->oldest].newer;
+	Shard* sh = &p->slots[slot];
+	if(sh->shard != NO_ROOM){
+		p->slotOf[sh->shard] = NO_ROOM;
+	}
+	if(loadShard(p, sh, shard) == -1){
+		sh->shard = NO_ROOM;
+		p->errors++;
+		return NULL;
+	}
+	p->slotOf[shard] = slot;
+	touchSlot(p, slot);
+	return sh;
+}
+
+//Function to read every shard of the paged maze m once, so that a
+//shard which cannot be read is found before the maze is played.
+//Returns -1 (having reported it) if one cannot be read.
+int checkShards(const Maze* m){
+	Pager* p = m->pager;
+	uint64_t room;
+	for(room = 0; room < m->numRooms; room += p->shardRooms){
+		if(getShard(p, (uint32_t)room) == NULL){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//Function to close a paged maze and free its shard cache (which may
+//only be partly set up).
+void freePager(Pager* p){
+	uint32_t k;
+	for(k = 0; k < p->numSlots; k++){
+		free(p->slots[k].nameIndex);
+		free(p->slots[k].adjIndex);
+		free(p->slots[k].adj);
+		free(p->slots[k].strings);
+	}
+	free(p->slots);
+	free(p->slotOf);
+	close(p->fd);
+	free(p);
+}
+
+//Function to open the maze file fileName as a paged maze, caching at
+//most numSlots shards of shardRooms rooms each. Only the header is
+//read; rooms are read as they are first reached. Returns -1 (having
+//reported why) if the file cannot be used.
+int pageMaze(const char* fileName, Maze* m, uint32_t numSlots, uint32_t shardRooms, int prefetch){
+	
+	Pager* p;
+	if((p = calloc(1, sizeof(Pager))) == NULL){
+		perror("Error allocating memory for shard cache");
+		return -1;
+	}
+	if((p->fd = open(fileName, O_RDONLY | O_CLOEXEC)) == -1){
+		perror(fileName);
+		free(p);
+		return -1;
+	}
+	struct stat fileAttributes;
+	if(fstat(p->fd, &fileAttributes) == -1){
+		perror(fileName);
+		freePager(p);
+		return -1;
+	}
+	const MazeHeader* h = &p->header;
+	uint64_t size = (uint64_t)fileAttributes.st_size;
+	if(size < sizeof(MazeHeader) || 
+	   pread(p->fd, &p->header, sizeof(MazeHeader), 0) != sizeof(MazeHeader)){
+		fprintf(stderr, "%s: not a maze file\n", fileName);
+		freePager(p);
+		return -1;
+	}
+	if(checkMazeHeader(fileName, h, size) == -1){
+		freePager(p);
+		return -1;
+	}
+	countStat(&stats.syscalls, 3);
+	uint64_t n = h->numRooms;
+
+	//At least 4 slots are kept, so the pinned shard and two names
+	//(as in solve()) never push each other out, but there is no point
+	//holding more shards than there are.
+	p->shardRooms = shardRooms;
+	p->numShards = (uint32_t)((n + shardRooms - 1) / shardRooms);
+	numSlots = numSlots < 4 ? 4 : numSlots;
+	if(numSlots > p->numShards){
+		numSlots = p->numShards;
+	}
+	p->prefetch = prefetch;
+	p->slotOf = malloc((size_t)p->numShards * sizeof(uint32_t));
+	if(p->slotOf == NULL || (p->slots = calloc(numSlots, sizeof(Shard))) == NULL){
+		perror("Error allocating memory for shard cache");
+		freePager(p);
+		return -1;
+	}
+	p->numSlots = numSlots;
+	uint32_t k;
+	for(k = 0; k < p->numShards; k++){
+		p->slotOf[k] = NO_ROOM;
+	}
+	for(k = 0; k < p->numSlots; k++){
+		p->slots[k].shard = NO_ROOM;
+		p->slots[k].newer = k > 0 ? k - 1 : NO_ROOM;
+		p->slots[k].older = k + 1 < p->numSlots ? k + 1 : NO_ROOM;
+		p->slots[k].nameIndex = malloc(((size_t)shardRooms + 1) * sizeof(uint32_t));
+		p->slots[k].adjIndex = malloc(((size_t)shardRooms + 1) * sizeof(uint32_t));
+		if(p->slots[k].nameIndex == NULL || p->slots[k].adjIndex == NULL){
+			perror("Error allocating memory for shard cache");
+			freePager(p);
+			return -1;
+		}
+	}
+	countStat(&stats.allocations, 3 + 2 * p->numSlots);
+	p->pinned = NO_ROOM;
+	p->newest = 0;
+	p->oldest = p->numSlots - 1;
+
+	memset(m, 0, sizeof(Maze));
+	m->numRooms = h->numRooms;
+	m->startRoom = h->startRoom;
+	m->endRoom = h->endRoom;
+	m->pager = p;
+	return 0;
+}
+
+//Maze compiled into the program, if a file generated by --compile
+//(see compileMaze()) was linked in; otherwise its address is NULL.
+extern const BuiltinMaze builtinMaze __attribute__((weak));
+
+//Function to point the Maze arrays and name index at the compiled
+//in maze b. Nothing is read, parsed or hashed, and the arrays stay
+//in the program's read-only data.
+void loadBuiltin(Maze* m, const BuiltinMaze* b){
+	m->numRooms = b->numRooms;
+	m->startRoom = b->startRoom;
+	m->endRoom = b->endRoom;
+	m->nameIndex = b->nameIndex;
+	m->adjIndex = b->adjIndex;
+	m->adj = b->adj;
+	m->strings = b->strings;
+	m->index.seed = b->hashSeed;
+	m->index.numBuckets = b->numBuckets;
+	m->index.numSlots = b->numSlots;
+	m->index.displace = b->displace;
+	m->index.slots = b->slots;
+	m->block = NULL;
+	m->map = NULL;
+	m->mapSize = 0;
+	m->builtin = 1;
+	m->pager = NULL;
+}
+
+//Function to write one const uint32_t array of a compiled maze.
+void writeTable(FILE* fp, const char* name, const uint32_t* a, size_t n){
+	fprintf(fp, "\nstatic const uint32_t %s[] = {", name);
+	size_t i;
+	for(i = 0; i < n; i++){
+		fprintf(fp, "%s%u,", i % 12 == 0 ? "\n\t" : " ", a[i]);
+	}
+	//Keep the array non-empty.
+	if(n == 0){
+		fprintf(fp, "\n\t0");
+	}
+	fprintf(fp, "\n};\n");
+}
+
+//Function to compile maze m (with its name index) into the C source
+//file fileName, defining the builtinMaze that loadBuiltin() uses when
+//the file is linked into the game.
+void compileMaze(const Maze* m, const char* fileName){
+	
+	FILE* fp;
+	if((fp = fopen(fileName, "w")) == NULL){
+		perror(fileName);
+		exit(EXIT_FAILURE);
+	}
+	//The names are written back to back, so their offsets are
+	//recomputed rather than copied.
+	uint32_t n = m->numRooms, i;
+	uint32_t* offsets;
+	if((offsets = malloc(((size_t)n + 1) * sizeof(uint32_t))) == NULL){
+		perror("Error allocating memory for name index");
+		exit(EXIT_FAILURE);
+	}
+	offsets[0] = 0;
+	for(i = 0; i < n; i++){
+		offsets[i + 1] = offsets[i] + strlen(roomName(m, i)) + 1;
+	}
+
+	fprintf(fp, "//Maze of %u rooms generated by fridkisb.adventure --compile. Do not edit.\n"
+		"//Link it into the game to play this maze without loading any files:\n"
+		"//gcc -o fridkisb.adventure fridkisb.adventure.c %s -lpthread\n\n"
+		"#include \"fridkisb.maze.h\"\n", n, fileName);
+	writeTable(fp, "nameIndex", offsets, n);
+	writeTable(fp, "adjIndex", m->adjIndex, (size_t)n + 1);
+	writeTable(fp, "adj", m->adj, m->adjIndex[n]);
+	writeTable(fp, "displace", m->index.displace, m->index.numBuckets);
+	writeTable(fp, "slots", m->index.slots, m->index.numSlots);
+
+	//Names are written one string literal each, with every character
+	//that is not a letter, digit or underscore as a 3 digit octal
+	//escape (which can never run into the next character).
+	fprintf(fp, "\nstatic const char strings[] =");
+	for(i = 0; i < n; i++){
+		const char* c = roomName(m, i);
+		fprintf(fp, "\n\t\"");
+		for(; *c != '\0'; c++){
+			if((*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z') || 
+			   (*c >= '0' && *c <= '9') || *c == '_'){
+				fputc(*c, fp);
+			}
+			else{
+				fprintf(fp, "\\%03o", (unsigned char)*c);
+			}
+		}
+		fprintf(fp, "\\0\"");
+	}
+	fprintf(fp, ";\n");
+
+	fprintf(fp, "\nconst BuiltinMaze builtinMaze = {\n"
+		"\t%u, %u, %u,\n"
+		"\tnameIndex, adjIndex, adj, strings,\n"
+		"\t%luULL, %u, %u, displace, slots\n"
+		"};\n", n, m->startRoom, m->endRoom, (unsigned long)m->index.seed, 
+		m->index.numBuckets, m->index.numSlots);
+	if(fclose(fp) != 0){
+		perror(fileName);
+		exit(EXIT_FAILURE);
+	}
+	free(offsets);
+}
+
+//Function to compute a checksum of maze m's rooms, names and
+//connections, so a checkpoint (see writeCheckpoint()) is only
+//resumed in the maze it was saved from.
+uint64_t checksumMaze(const Maze* m){
+	
+	uint64_t h = mix64(((uint64_t)m->numRooms << 32) ^ m->startRoom) ^ mix64(m->endRoom);
+	uint32_t i, k, degree;
+	for(i = 0; i < m->numRooms; i++){
+		const uint32_t* links = roomLinks(m, i, &degree);
+		h = mix64(h ^ hashName(roomName(m, i), degree));
+		for(k = 0; k < degree; k++){
+			h = (h ^ links[k]) * 0x9E3779B97F4A7C15ULL;
+		}
+	}
+	return mix64(h);
+}
+
+//Function to return maze m's checksum. It is computed the first time
+//it is needed (by the first save or resume), so that starting a game
+//never passes over every room. Server workers may compute it at the
+//same time; they all store the same value.
+uint64_t mazeChecksum(const Maze* m){
+	Maze* cache = (Maze*)m;		//The checksum is not part of the maze
+	if(!__atomic_load_n(&m->haveChecksum, __ATOMIC_ACQUIRE)){
+		//(A paged maze which could not read every room keeps trying.)
+		uint32_t errors = mazeErrors(m);
+		__atomic_store_n(&cache->checksum, checksumMaze(m), __ATOMIC_RELAXED);
+		__atomic_store_n(&cache->haveChecksum, mazeErrors(m) == errors, __ATOMIC_RELEASE);
+	}
+	return __atomic_load_n(&m->checksum, __ATOMIC_RELAXED);
+}
+
+//Function to release the memory (or mapping) held by a Maze.
+void unloadMaze(Maze* m){
+	if(m->builtin){
+		return;
+	}
+	if(m->pager != NULL){
+		freePager(m->pager);
+		m->pager = NULL;
+		return;
+	}
+	if(m->map != NULL){
+		munmap(m->map, m->mapSize);
+	}
+	free(m->block);
+	freeNameIndex(&m->index);
+	m->map = m->block = NULL;
+}
+
+//How a rooms directory is loaded (see loadDirectory()): the threads
+//used to load room files, and the shards to cache, rooms per shard
+//and read ahead of a paged maze file (see pageMaze()). A pageCache of
+//0 maps maze files whole.
+typedef struct {
+	int numThreads;
+	uint32_t pageCache;
+	uint32_t shardRooms;
+	int prefetch;
+} LoadOptions;
+
+//Function to load the maze in the rooms directory dirName (the
+//current directory if empty) into m, without changing directory:
+//the binary maze file if the generator wrote one, otherwise the
+//contents of each room file. Returns -1 (having reported why) if the
+//maze cannot be loaded.
+int loadDirectory(Maze* m, const char* dirName, const LoadOptions* lo){
+	
+	if(dirName[0] == '\0'){
+		dirName = ".";
+	}
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s", dirName, MAZE_FILE_NAME);
+	if(access(path, R_OK) == 0 && lo->pageCache > 0){
+		return pageMaze(path, m, lo->pageCache, lo->shardRooms, lo->prefetch);
+	}
+	else if(access(path, R_OK) == 0){
+		return mapMaze(path, m);
+	}
+	return loadRooms(m, dirName, lo->numThreads);
+}
+
+//Buffers for shortest path queries (see findPath()), allocated once
+//per maze and reused by every query. Rather than clearing them for
+//each query, a room counts as visited only if its mark holds the
+//current query's stamp; the low bit of the mark records which side
+//of the search (0 forward, 1 backward) reached it.
+typedef struct {
+	uint32_t numRooms;
+	uint32_t stamp;
+	uint32_t* mark;
+	uint32_t* dist;				//Distance from the side that reached it
+	uint32_t* link;				//Previous room (forward) or next room (backward)
+	uint32_t* queue[2];			//Rooms reached by each side, in BFS order
+	uint32_t* route;			//Path found by the last query
+} PathFinder;
+
+//Function to allocate the query buffers for maze m.
+void initPathFinder(PathFinder* pf, const Maze* m){
+	size_t n = m->numRooms;
+	pf->numRooms = m->numRooms;
+	pf->stamp = 0;
+	pf->mark = calloc(n, sizeof(uint32_t));
+	pf->dist = malloc(n * sizeof(uint32_t));
+	pf->link = malloc(n * sizeof(uint32_t));
+	pf->queue[0] = malloc(n * sizeof(uint32_t));
+	pf->queue[1] = malloc(n * sizeof(uint32_t));
+	pf->route = malloc(n * sizeof(uint32_t));
+	if(pf->mark == NULL || pf->dist == NULL || pf->link == NULL || 
+	   pf->queue[0] == NULL || pf->queue[1] == NULL || pf->route == NULL){
+		perror("Error allocating memory for path finder");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Function to free the query buffers.
+void freePathFinder(PathFinder* pf){
+	free(pf->mark);
+	free(pf->dist);
+	free(pf->link);
+	free(pf->queue[0]);
+	free(pf->queue[1]);
+	free(pf->route);
+	pf->mark = NULL;
+}
+
+//Function to find a shortest path from room from to room to with a
+//bidirectional breadth first search: one search expands forward from
+//from, the other backward from to (connections are two-way, as
+//fridkisb.buildrooms writes them), always growing the side with the
+//smaller frontier by one whole level. Once the sides meet, the
+//shortest of the meeting points found in that level gives the path.
+//The rooms after from (ending with to) are stored in pf->route.
+//Returns the number of steps, or -1 if to cannot be reached.
+int findPath(PathFinder* pf, const Maze* m, uint32_t from, uint32_t to){
+	
+	if(from == to){
+		return 0;
+	}
+
+	//Start a new query, clearing the marks only when the stamps wrap.
+	pf->stamp += 2;
+	if(pf->stamp == 0){
+		memset(pf->mark, 0, pf->numRooms * sizeof(uint32_t));
+		pf->stamp = 2;
+	}
+	uint32_t stamp = pf->stamp;
+
+	uint32_t head[2] = {0, 0}, tail[2] = {1, 1};
+	pf->queue[0][0] = from;
+	pf->queue[1][0] = to;
+	pf->mark[from] = stamp;
+	pf->mark[to] = stamp | 1;
+	pf->dist[from] = pf->dist[to] = 0;
+	pf->link[from] = pf->link[to] = NO_ROOM;
+
+	uint32_t meetFrom = NO_ROOM, meetTo = NO_ROOM, best = UINT32_MAX;
+	while(head[0] < tail[0] && head[1] < tail[1]){
+		int side = (tail[0] - head[0]) <= (tail[1] - head[1]) ? 0 : 1;
+		uint32_t* queue = pf->queue[side];
+		uint32_t levelEnd = tail[side];
+		while(head[side] < levelEnd){
+			uint32_t u = queue[head[side]++];
+			uint32_t j, degree;
+			const uint32_t* links = roomLinks(m, u, &degree);
+			for(j = 0; j < degree; j++){
+				uint32_t v = links[j];
+				if(pf->mark[v] == (stamp | side)){
+					continue;
+				}
+				if(pf->mark[v] == (stamp | !side)){
+					//The sides meet across u-v.
+					uint32_t total = pf->dist[u] + 1 + pf->dist[v];
+					if(total < best){
+						best = total;
+						meetFrom = side == 0 ? u : v;
+						meetTo = side == 0 ? v : u;
+					}
+					continue;
+				}
+				pf->mark[v] = stamp | side;
+				pf->dist[v] = pf->dist[u] + 1;
+				pf->link[v] = u;
+				queue[tail[side]++] = v;
+			}
+		}
+		if(best != UINT32_MAX){
+			break;
+		}
+	}
+	if(best == UINT32_MAX){
+		return -1;
+	}
+
+	//Walk back from the meeting point to from, then forward to to.
+	uint32_t* path = pf->route;
+	uint32_t k = pf->dist[meetFrom];
+	uint32_t r;
+	for(r = meetFrom; r != from; r = pf->link[r]){
+		path[--k] = r;
+	}
+	k = pf->dist[meetFrom];
+	for(r = meetTo; r != NO_ROOM; r = pf->link[r]){
+		path[k++] = r;
+	}
+	return (int)best;
+}
+
+//Growable output buffer. Game output is composed here and then
+//written out (to stdout or a session's socket) by the caller.
+typedef struct {
+	char* data;
+	size_t used;
+	size_t size;
+} Buffer;
+
+//Function to make room for len more bytes in buffer b.
+void reserveBuffer(Buffer* b, size_t len){
+	if(b->used + len > b->size){
+		size_t size = b->size ? b->size : 256;
+		while(size < b->used + len){
+			size *= 2;
+		}
+		if((b->data = realloc(b->data, size)) == NULL){
+			perror("Error allocating memory for output");
+			exit(EXIT_FAILURE);
+		}
+		countStat(&stats.allocations, 1);
+		b->size = size;
+	}
+}
+
+//Function to append len bytes of data to buffer b.
+void appendBuffer(Buffer* b, const char* data, size_t len){
+	reserveBuffer(b, len);
+	memcpy(b->data + b->used, data, len);
+	b->used += len;
+}
+
+//Function to append printf-style formatted output to buffer b.
+void printBuffer(Buffer* b, const char* format, ...){
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	reserveBuffer(b, len + 1);
+	va_start(args, format);
+	vsnprintf(b->data + b->used, len + 1, format, args);
+	va_end(args);
+	b->used += len;
+}
+
+//Function to write all of buffer b to fd (retrying short writes),
+//then empty it.
+void writeBuffer(Buffer* b, int fd){
+	size_t done = 0;
+	while(done < b->used){
+		ssize_t n = write(fd, b->data + done, b->used - done);
+		if(n == -1 && errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			perror("Error writing output");
+			exit(EXIT_FAILURE);
+		}
+		done += n;
+		countStat(&stats.syscalls, 1);
+	}
+	b->used = 0;
+}
+
+//Function to free the memory held by buffer b.
+void freeBuffer(Buffer* b){
+	free(b->data);
+	b->data = NULL;
+	b->used = b->size = 0;
+}
+
+//State of one player's game. Everything else (the maze and its name
+//index) is shared read-only, so many sessions can play one maze.
+typedef struct {
+	uint32_t room;				//Current room
+	Path path;					//Rooms visited so far
+	struct Checkpoint* saving;	//Save not yet committed (see TURN_SAVE)
+} Session;
+
+//Results of takeTurn().
+enum { TURN_MOVED, TURN_TIME, TURN_SAVE, TURN_OTHER, TURN_INVALID, TURN_DONE, TURN_FAILED };
+
+//Function to check whether maze m has failed to read a room (see
+//mazeErrors()) since it had errors errors. If so, whatever was
+//appended to out after its first used bytes is replaced by the
+//message ending the game, and -1 is returned.
+int lostMaze(const Maze* m, uint32_t errors, Buffer* out, size_t used){
+	if(mazeErrors(m) == errors){
+		return 0;
+	}
+	out->used = used;
+	printBuffer(out, "\n\nTHE MAZE COULD NOT BE READ, SO THE GAME IS OVER.\n");
+	return -1;
+}
+
+//Function to start a session in maze m's START_ROOM.
+void initSession(Session* s, const Maze* m){
+	s->room = m->startRoom;
+	initPath(&s->path, 16);
+	s->saving = NULL;
+}
+
+//Function to append the prompt for the session's current room to out.
+//Returns -1 (with the message ending the game instead) if the room
+//could not be read.
+int promptSession(const Maze* m, const Session* s, Buffer* out){
+	
+	uint32_t errors = mazeErrors(m);
+	size_t used = out->used;
+	uint32_t cr = s->room, j, degree;
+	printBuffer(out, "CURRENT LOCATION: %s\n"
+		   "POSSIBLE CONNECTIONS: ", roomName(m, cr));
+	const uint32_t* links = roomLinks(m, cr, &degree);
+	for(j = 0; j < degree; j++){
+		if(j != degree - 1){
+			printBuffer(out, "%s ", roomName(m, links[j]));
+		}
+		else{
+			printBuffer(out, "%s.\n"
+				   "WHERE TO >", roomName(m, links[j]));
+		}
+	}
+	return lostMaze(m, errors, out, used);
+}
+
+//Where printPathRoom() prints to.
+typedef struct {
+	const Maze* maze;
+	Buffer* out;
+} PathPrinter;
+
+//Function to append one room of a path to the printer's output
+//(called through walkPath()).
+void printPathRoom(uint32_t room, void* arg){
+	PathPrinter* pp = arg;
+	const char* name = roomName(pp->maze, room);
+	size_t len = strlen(name);
+	reserveBuffer(pp->out, len + 1);
+	memcpy(pp->out->data + pp->out->used, name, len);
+	pp->out->data[pp->out->used + len] = '\n';
+	pp->out->used += len + 1;
+}
+
+//Function to append the congratulations message and game stats
+//(steps taken & path) to out. Returns -1 (with the message ending the
+//game instead) if a room on the path could not be read.
+int finishSession(const Maze* m, const Session* s, Buffer* out){
+	uint32_t errors = mazeErrors(m);
+	size_t used = out->used;
+	printBuffer(out, "YOU HAVE FOUND THE END ROOM. CONGRATULATIONS!\n"
+		   "YOU TOOK %d STEPS. YOUR PATH TO VICTORY WAS:\n", (int)pathLength(&s->path));
+	PathPrinter pp = {m, out};
+	walkPath(&s->path, printPathRoom, &pp);
+	return lostMaze(m, errors, out, used);
+}
+
+//A checkpoint file holds one saved session: this header, then the
+//IDs of the rooms in its path as a uint32_t array. It is read back by
+//mapping it, so resuming a session is a few header checks and one
+//copy of the path, however long.
+#define CHECKPOINT_MAGIC "FRIDSAVE"
+#define CHECKPOINT_VERSION 1
+
+typedef struct {
+	char magic[8];				//CHECKPOINT_MAGIC (not null-terminated)
+	uint32_t version;			//CHECKPOINT_VERSION
+	uint32_t numRooms;			//Rooms in the maze saved from
+	uint64_t mazeChecksum;		//checksumMaze() of that maze
+	uint32_t room;				//Current room
+	uint32_t reserved;
+	uint64_t pathLength;		//IDs following the header
+} CheckpointHeader;
+
+//Checkpoint used by "save" and "resume" when no name is given.
+#define SAVE_NAME "fridkisb"
+
+//Ending of every checkpoint file, and the longest name a player may
+//give one.
+#define SAVE_SUFFIX ".save"
+#define MAX_SAVE_NAME 64
+
+//Numbers the temporary files of saves in progress (see
+//writeCheckpoint()).
+static uint32_t saveCount = 0;
+
+//Function to turn a checkpoint name given by a player into the name
+//of its file, "<name>.save" in the directory the game was started in.
+//Server clients pick these names too, so they are limited to letters,
+//digits, '_' and '-', and can never name any other file. Returns NULL
+//if the name is acceptable, or the problem.
+const char* checkpointName(const char* name, char* fileName, size_t size){
+	size_t len = strspn(name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+		"0123456789_-");
+	if(len == 0 || name[len] != '\0'){
+		return "NOT A VALID NAME";
+	}
+	if(len > MAX_SAVE_NAME){
+		return "NAME TOO LONG";
+	}
+	snprintf(fileName, size, "%s%s", name, SAVE_SUFFIX);
+	return NULL;
+}
+
+//Function to check that name can be saved to: either nothing has that
+//name yet, or it is a regular file holding a checkpoint. Returns 0 if
+//so, otherwise -1 with errno set.
+int replaceableCheckpoint(const char* name){
+	struct stat fileAttributes;
+	if(lstat(name, &fileAttributes) == -1){
+		return errno == ENOENT ? 0 : -1;
+	}
+	char magic[sizeof(CHECKPOINT_MAGIC) - 1];
+	int fd = -1;
+	if(!S_ISREG(fileAttributes.st_mode) || 
+	   (fd = open(name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1 ||
+	   read(fd, magic, sizeof(magic)) != (ssize_t)sizeof(magic) ||
+	   memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0){
+		if(fd != -1){
+			close(fd);
+		}
+		errno = EEXIST;
+		return -1;
+	}
+	close(fd);
+	countStat(&stats.syscalls, 4);
+	return 0;
+}
+
+//Where writeCheckpoint() writes the path to.
+typedef struct {
+	int fd;
+	int error;					//errno of the first failed write (or 0)
+	uint32_t block[16384];
+	size_t used;
+} CheckpointWriter;
+
+//Function to write out the data collected by a CheckpointWriter.
+void flushCheckpoint(CheckpointWriter* cw){
+	size_t len = cw->used * sizeof(uint32_t);
+	ssize_t n;
+	if(cw->error == 0 && (n = write(cw->fd, cw->block, len)) != (ssize_t)len){
+		cw->error = n == -1 ? errno : ENOSPC;
+	}
+	countStat(&stats.syscalls, 1);
+	cw->used = 0;
+}
+
+//Function to add one room of a path to a checkpoint (called through
+//walkPath()).
+void writeCheckpointRoom(uint32_t room, void* arg){
+	CheckpointWriter* cw = arg;
+	if(cw->used == sizeof(cw->block) / sizeof(uint32_t)){
+		flushCheckpoint(cw);
+	}
+	cw->block[cw->used++] = room;
+}
+
+//A save in progress: the checkpoint is written to a temporary file
+//by writeCheckpoint(), then synced and renamed into place by
+//commitCheckpoint(). The two halves are split so the game server can
+//leave the slow sync to another thread (see SaveService).
+typedef struct Checkpoint {
+	int fd;						//Temporary file (-1 once closed)
+	int error;					//errno of the first failure (or 0)
+	char tmpName[256];
+	char fileName[MAX_SAVE_NAME + sizeof(SAVE_SUFFIX)];
+} Checkpoint;
+
+//Function to write session s of maze m to a temporary file, to be
+//committed to the checkpoint file name by commitCheckpoint(). A file
+//that is not a checkpoint is never replaced. Returns NULL (with errno
+//set) on failure.
+Checkpoint* writeCheckpoint(const Maze* m, const Session* s, const char* name){
+	
+	if(replaceableCheckpoint(name) == -1){
+		return NULL;
+	}
+	Checkpoint* cp;
+	CheckpointWriter* cw;
+	if((cp = malloc(sizeof(Checkpoint))) == NULL){
+		return NULL;
+	}
+	if((cw = malloc(sizeof(CheckpointWriter))) == NULL){
+		free(cp);
+		return NULL;
+	}
+	countStat(&stats.allocations, 2);
+	snprintf(cp->fileName, sizeof(cp->fileName), "%s", name);
+	snprintf(cp->tmpName, sizeof(cp->tmpName), "%s.%d.%u", name, (int)getpid(), 
+		__atomic_fetch_add(&saveCount, 1, __ATOMIC_RELAXED));
+	if((cw->fd = open(cp->tmpName, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1){
+		free(cw);
+		free(cp);
+		return NULL;
+	}
+	countStat(&stats.syscalls, 1);
+
+	//The header goes at the start of the first block, so a short path
+	//is saved with a single write.
+	CheckpointHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+	h.version = CHECKPOINT_VERSION;
+	h.numRooms = m->numRooms;
+	h.mazeChecksum = mazeChecksum(m);
+	h.room = s->room;
+	h.pathLength = pathLength(&s->path);
+	memcpy(cw->block, &h, sizeof(h));
+	cw->used = sizeof(h) / sizeof(uint32_t);
+	cw->error = 0;
+	walkPath(&s->path, writeCheckpointRoom, cw);
+	flushCheckpoint(cw);
+	
+	cp->fd = cw->fd;
+	cp->error = cw->error;
+	free(cw);
+	return cp;
+}
+
+//Function to finish a save begun by writeCheckpoint(): the temporary
+//file is synced and renamed over the checkpoint, so the checkpoint
+//always holds either the old or the new save in full, even if the
+//game is killed part way. Any failure is left in cp->error.
+void commitCheckpoint(Checkpoint* cp){
+	
+	int error = cp->error;
+	if(error == 0 && fdatasync(cp->fd) == -1){
+		error = errno;
+	}
+	if(close(cp->fd) == -1 && error == 0){
+		error = errno;
+	}
+	cp->fd = -1;
+	if(error == 0 && rename(cp->tmpName, cp->fileName) == -1){
+		error = errno;
+	}
+	if(error != 0){
+		unlink(cp->tmpName);
+	}
+	countStat(&stats.syscalls, 3);
+	cp->error = error;
+}
+
+//Function to free session s's save, removing its temporary file if it
+//was never committed.
+void dropCheckpoint(Session* s){
+	Checkpoint* cp = s->saving;
+	if(cp->fd != -1){
+		close(cp->fd);
+		unlink(cp->tmpName);
+	}
+	free(cp);
+	s->saving = NULL;
+}
+
+//Function to report the outcome of session s's committed save to out,
+//and free it.
+void finishSave(Session* s, Buffer* out){
+	Checkpoint* cp = s->saving;
+	if(cp->error != 0){
+		printBuffer(out, "\n\nCOULD NOT SAVE TO %s: %s.\n\n\n", cp->fileName, 
+			strerror(cp->error));
+	}
+	else{
+		printBuffer(out, "\n\nGAME SAVED TO %s.\n\n\n", cp->fileName);
+	}
+	dropCheckpoint(s);
+}
+
+//Function to commit and report session s's save (for a TURN_SAVE
+//result played where waiting for the sync holds up no one else).
+void saveTurn(Session* s, Buffer* out){
+	commitCheckpoint(s->saving);
+	finishSave(s, out);
+}
+
+//Function to restore session s of maze m from the checkpoint file
+//name. Returns NULL on success, otherwise the reason the checkpoint
+//cannot be used (the session is then unchanged).
+const char* resumeSession(const Maze* m, Session* s, const char* name){
+	
+	int fd;
+	if((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1){
+		return strerror(errno);
+	}
+	struct stat fileAttributes;
+	if(fstat(fd, &fileAttributes) == -1){
+		close(fd);
+		return strerror(errno);
+	}
+	size_t size = (size_t)fileAttributes.st_size;
+	if(size < sizeof(CheckpointHeader)){
+		close(fd);
+		return "NOT A SAVED GAME";
+	}
+	void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	countStat(&stats.syscalls, 4);
+	if(map == MAP_FAILED){
+		return strerror(errno);
+	}
+
+	const CheckpointHeader* h = map;
+	const uint32_t* rooms = (const uint32_t*)(h + 1);
+	const char* problem = NULL;
+	uint64_t k;
+	if(memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) != 0 || 
+	   h->version != CHECKPOINT_VERSION || 
+	   (size - sizeof(CheckpointHeader)) % sizeof(uint32_t) != 0 ||
+	   h->pathLength != (size - sizeof(CheckpointHeader)) / sizeof(uint32_t)){
+		problem = "NOT A SAVED GAME";
+	}
+	else if(h->numRooms != m->numRooms || h->mazeChecksum != mazeChecksum(m)){
+		problem = "SAVED IN A DIFFERENT MAZE";
+	}
+	else if(h->room >= m->numRooms || 
+	   h->room != (h->pathLength > 0 ? rooms[h->pathLength - 1] : m->startRoom)){
+		problem = "SAVED GAME IS DAMAGED";
+	}
+	for(k = 0; problem == NULL && k < h->pathLength; k++){
+		if(rooms[k] >= m->numRooms){
+			problem = "SAVED GAME IS DAMAGED";
+		}
+	}
+
+	//Replace the session's path with the saved one in a single copy
+	//(spilling it if it is over the --path-spill limit).
+	if(problem == NULL){
+		size_t len = (size_t)h->pathLength;
+		freePath(&s->path);
+		initPath(&s->path, len < 16 ? 16 : len);
+		memcpy(s->path.rooms, rooms, len * sizeof(uint32_t));
+		s->path.used = len;
+		if(pathSpillLimit > 0 && len > pathSpillLimit){
+			spillPath(&s->path);
+			s->path.size = pathSpillLimit;
+			if((s->path.rooms = realloc(s->path.rooms, 
+			    s->path.size * sizeof(uint32_t))) == NULL){
+				perror("Error allocating memory for dynamic array");
+				exit(EXIT_FAILURE);
+			}
+		}
+		s->room = h->room;
+		countStat(&stats.bytesRead, size);
+	}
+	munmap(map, size);
+	return problem;
+}
+
+//Function to play one line of input in session s (see takeTurn()).
+int playTurn(const Maze* m, Session* s, const char* input, PathFinder* pf, Buffer* out){
+	
+	//Look the input up in the name index, and if it is a
+	//connection of the current room, assign current room to
+	//room entered by user, and update path array. A paged maze has
+	//no name index, so the input is compared with the name of each
+	//connection instead.
+	uint32_t degree, j;
+	const uint32_t* links = roomLinks(m, s->room, &degree);
+	uint32_t next = m->pager == NULL ? findRoom(m, input) : NO_ROOM;
+	for(j = 0; m->pager != NULL && j < degree; j++){
+		if(strcmp(input, roomName(m, links[j])) == 0){
+			next = links[j];
+		}
+	}
+	for(j = 0; next != NO_ROOM && j < degree; j++){
+		if(links[j] == next){
+			s->room = next;
+			insertPath(&s->path, next);
+			countStat(&stats.moves, 1);
+			appendBuffer(out, "\n\n", 2);
+			if(next == m->endRoom){
+				finishSession(m, s, out);
+				return TURN_DONE;
+			}
+			return TURN_MOVED;
+		}
+	}
+
+	if(strcmp(input, "time") == 0){
+		return TURN_TIME;
+	}
+	
+	//If user input is 'hint', show the next room on a shortest path
+	//to the end room.
+	if(strcmp(input, "hint") == 0){
+		countStat(&stats.hints, 1);
+		if(pf->mark == NULL){
+			initPathFinder(pf, m);
+		}
+		int len = findPath(pf, m, s->room, m->endRoom);
+		if(len < 0){
+			printBuffer(out, "\n\nHINT: THERE IS NO WAY OUT FROM HERE.\n\n\n");
+		}
+		else{
+			printBuffer(out, "\n\nHINT: TRY %s (THE END ROOM IS %d STEPS AWAY).\n\n\n", 
+				roomName(m, pf->route[0]), len);
+		}
+		return TURN_OTHER;
+	}
+
+	//If user input is 'save' or 'resume' (optionally followed by a
+	//checkpoint name), save the game to or restore it from that
+	//checkpoint file.
+	char fileName[MAX_SAVE_NAME + sizeof(SAVE_SUFFIX)];
+	if(strncmp(input, "save", 4) == 0 && (input[4] == '\0' || input[4] == ' ')){
+		const char* name = input[4] == ' ' ? input + 5 : SAVE_NAME;
+		const char* problem = checkpointName(name, fileName, sizeof(fileName));
+		if(problem == NULL && (s->saving = writeCheckpoint(m, s, fileName)) == NULL){
+			problem = strerror(errno);
+		}
+		if(problem != NULL){
+			printBuffer(out, "\n\nCOULD NOT SAVE %s: %s.\n\n\n", name, problem);
+			return TURN_OTHER;
+		}
+		return TURN_SAVE;
+	}
+	if(strncmp(input, "resume", 6) == 0 && (input[6] == '\0' || input[6] == ' ')){
+		const char* name = input[6] == ' ' ? input + 7 : SAVE_NAME;
+		const char* problem = checkpointName(name, fileName, sizeof(fileName));
+		if(problem == NULL){
+			problem = resumeSession(m, s, fileName);
+		}
+		if(problem != NULL){
+			printBuffer(out, "\n\nCOULD NOT RESUME %s: %s.\n\n\n", name, problem);
+			return TURN_OTHER;
+		}
+		printBuffer(out, "\n\nGAME RESUMED FROM %s (%zu STEPS TAKEN).\n\n\n", 
+			fileName, pathLength(&s->path));
+		if(s->room == m->endRoom){
+			finishSession(m, s, out);
+			return TURN_DONE;
+		}
+		return TURN_OTHER;
+	}
+
+	//Else input is not a valid room connection, print message to user
+	//accordingly.
+	countStat(&stats.invalidInputs, 1);
+	printBuffer(out, "\n\nHUH? I DON'T UNDERSTAND THAT ROOM. TRY AGAIN.\n\n\n");
+	return TURN_INVALID;
+}
+
+//Function to play one line of input in session s, appending the
+//response to out. Returns TURN_MOVED if the player moved, TURN_DONE
+//if that move reached the END_ROOM (the congratulations message is
+//then included), TURN_INVALID for input that is not a connection or
+//command, and TURN_OTHER for other commands ("hint", "resume", and a
+//"save" that failed; a resumed game that is already over gives
+//TURN_DONE). The "time" command is left to the caller (TURN_TIME),
+//which appends the time with appendTime(), and so is committing a
+//save once its checkpoint is written (TURN_SAVE), with saveTurn() or
+//commitCheckpoint() and finishSave(). If a paged maze could not read
+//a room the turn needed, the game cannot go on: the response is the
+//message saying so, any save is dropped and the result is
+//TURN_FAILED. pf provides the buffers for hints, and is set up on
+//first use (pf->mark must start out NULL). With --stats, the time
+//taken is counted in the latency histogram.
+int takeTurn(const Maze* m, Session* s, const char* input, PathFinder* pf, Buffer* out){
+	double start = stats.enabled ? now() : 0;
+	uint32_t errors = mazeErrors(m);
+	size_t used = out->used;
+	int turn = playTurn(m, s, input, pf, out);
+	if(lostMaze(m, errors, out, used) == -1){
+		if(s->saving != NULL){
+			dropCheckpoint(s);
+		}
+		turn = TURN_FAILED;
+	}
+	if(stats.enabled && turn != TURN_TIME){
+		recordLatency(now() - start);
+	}
+	return turn;
+}
+
+//Function to append the response to the "time" command to out.
+void appendTime(const char* curTime, Buffer* out){
+	printBuffer(out, "\n\n  %s\n\n\n"
+		   "WHERE TO? >", curTime);
+}
+
+//Function to free the memory held by session s.
+void freeSession(Session* s){
+	freePath(&s->path);
+	if(s->saving != NULL){
+		dropCheckpoint(s);
+	}
+}
+
+//The "time" command is answered by one long-lived thread (see
+//timeThread()). Callers queue a request by bumping requests and wait
+//until answers catches up; the thread answers every request waiting
+//at that moment with a single formatted time, handed back through
+//curTime. If persist is set, the thread then writes that time to
+//currentTime.txt after the callers have their answer (only when it
+//differs from what the file already holds, as the time shown only
+//changes once a minute).
+typedef struct {
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t requested;	//Signalled when a request is queued
+	pthread_cond_t answered;	//Broadcast when requests are answered
+	unsigned long requests;		//Requests queued so far
+	unsigned long answers;		//Requests answered so far
+	char curTime[41];			//Latest answer
+	int persist;
+	int stop;
+} TimeService;
+
+static TimeService timeService;
+
+//Function to format the current time for the "time" command.
+void formatTime(char* curTime, size_t size){
+	time_t rawtime;
+	struct tm timeinfo;
+	time(&rawtime);
+	localtime_r(&rawtime, &timeinfo);
+	strftime(curTime, size, "%I:%M%p, %A, %B %d, %Y", &timeinfo);
+}
+
+//Function to write current time to currentTime.txt file with a single
+//write. Creates currentTime.txt file if it does not previously exist.
+void writeTime(const char* curTime){
+	
+	//Open file currentTime.text (and create, if necessary).
+	int fd;
+	if((fd = open("currentTime.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1){
+		perror("Error opening currentTime.txt");
+		return;
+	}
+	size_t len = strlen(curTime);
+	if(write(fd, curTime, len) != (ssize_t)len){
+		perror("Error writing to file currentTime.txt");
+	}
+	if((close(fd)) == -1){
+		perror("Error closing currentTime.txt");
+	}
+	countStat(&stats.syscalls, 3);
+}
+
+//Function run by the time thread: sleep until a request is queued,
+//answer all queued requests, then (outside the lock) persist the
+//answer if asked to.
+void* timeThread(void* arg){
+	
+	TimeService* ts = arg;
+	char curTime[41];
+	char persisted[41] = "";
+	pthread_mutex_lock(&ts->lock);
+	for(;;){
+		while(ts->answers == ts->requests && !ts->stop){
+			pthread_cond_wait(&ts->requested, &ts->lock);
+		}
+		if(ts->answers == ts->requests){
+			break;
+		}
+		double start = stats.enabled ? now() : 0;
+		formatTime(ts->curTime, sizeof(ts->curTime));
+		ts->answers = ts->requests;
+		pthread_cond_broadcast(&ts->answered);
+		
+		if(ts->persist && strcmp(ts->curTime, persisted) != 0){
+			memcpy(curTime, ts->curTime, sizeof(curTime));
+			pthread_mutex_unlock(&ts->lock);
+			writeTime(curTime);
+			memcpy(persisted, curTime, sizeof(persisted));
+			pthread_mutex_lock(&ts->lock);
+		}
+		if(stats.enabled){
+			stats.timeThread += now() - start;
+		}
+	}
+	pthread_mutex_unlock(&ts->lock);
+	return NULL;
+}
+
+//Function to start the time thread. persist selects whether answers
+//are also written to currentTime.txt.
+void startTimeService(int persist){
+	
+	TimeService* ts = &timeService;
+	ts->requests = ts->answers = 0;
+	ts->persist = persist;
+	ts->stop = 0;
+	if(pthread_mutex_init(&ts->lock, NULL) != 0 || 
+	   pthread_cond_init(&ts->requested, NULL) != 0 ||
+	   pthread_cond_init(&ts->answered, NULL) != 0){
+		perror("Failed to establish mutext");
+		exit(EXIT_FAILURE);
+	}
+	if((pthread_create(&ts->tid, NULL, timeThread, ts)) != 0){
+		perror("Error creating thread");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Function to get the current time from the time thread (blocking the
+//calling thread until it is answered). curTime must hold 41 bytes.
+void requestTime(char* curTime){
+	
+	TimeService* ts = &timeService;
+	countStat(&stats.timeRequests, 1);
+	pthread_mutex_lock(&ts->lock);
+	unsigned long ticket = ++ts->requests;
+	pthread_cond_signal(&ts->requested);
+	while(ts->answers < ticket){
+		pthread_cond_wait(&ts->answered, &ts->lock);
+	}
+	memcpy(curTime, ts->curTime, sizeof(ts->curTime));
+	pthread_mutex_unlock(&ts->lock);
+}
+
+//Function to stop the time thread once it has answered (and
+//persisted) every request.
+void stopTimeService(){
+	
+	TimeService* ts = &timeService;
+	pthread_mutex_lock(&ts->lock);
+	ts->stop = 1;
+	pthread_cond_signal(&ts->requested);
+	pthread_mutex_unlock(&ts->lock);
+	pthread_join(ts->tid, NULL);
+	pthread_cond_destroy(&ts->requested);
+	pthread_cond_destroy(&ts->answered);
+	pthread_mutex_destroy(&ts->lock);
+}
+
+//Longest line of input accepted from a server session or script.
+#define MAX_INPUT 255
+
+//Output a server session may have queued before it is dropped as
+//too slow to read its responses.
+#define MAX_PENDING (1 << 20)
+
+//A maze served by the game server (see serve()). When the server
+//watches for new mazes, a newer snapshot can replace this one while
+//sessions are still playing it, so every session holds a reference,
+//as does the server while the snapshot is the one new sessions get.
+//The maze is never changed once published, and is unloaded when the
+//last reference is dropped. Each worker has its own path finder
+//buffers (for hints) in every snapshot, sized for its maze, so a
+//worker playing sessions on an old and a new maze uses both without
+//setting either up again.
+typedef struct {
+	Maze maze;
+	uint32_t refs;
+	uint32_t generation;		//0 for the maze the server started with
+	PathFinder* finders;		//One per worker (set up on first use)
+	int numFinders;
+} Snapshot;
+
+//Function to allocate a snapshot (holding one reference) with a path
+//finder for each of numWorkers workers. Returns NULL if memory ran
+//out.
+Snapshot* newSnapshot(int numWorkers){
+	Snapshot* s;
+	if((s = calloc(1, sizeof(Snapshot))) == NULL){
+		return NULL;
+	}
+	if((s->finders = calloc(numWorkers, sizeof(PathFinder))) == NULL){
+		free(s);
+		return NULL;
+	}
+	s->numFinders = numWorkers;
+	s->refs = 1;
+	return s;
+}
+
+//Function to take a reference to snapshot s.
+void holdSnapshot(Snapshot* s){
+	__atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+}
+
+//Function to drop a reference to snapshot s, unloading its maze if
+//it was the last.
+void releaseSnapshot(Snapshot* s){
+	if(__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0){
+		int i;
+		for(i = 0; i < s->numFinders; i++){
+			if(s->finders[i].mark != NULL){
+				freePathFinder(&s->finders[i]);
+			}
+		}
+		free(s->finders);
+		unloadMaze(&s->maze);
+		free(s);
+	}
+}
+
+//One client connection of the game server (see serve()). Each
+//connection belongs to a single worker, so its state is only ever
+//touched by that worker's thread.
+typedef struct Connection {
+	int fd;
+	Snapshot* snapshot;			//Maze the session is playing
+	Session session;
+	char in[MAX_INPUT + 1];		//Input not yet ending in a newline
+	size_t inUsed;
+	Buffer out;					//Output not yet written to the socket
+	size_t outSent;
+	int done;					//Close once out has been written
+	int writing;				//Registered for EPOLLOUT
+	struct ServerWorker* worker;
+	struct Connection* prev;	//Worker's list of connections
+	struct Connection* next;
+	struct Connection* nextSave;	//Save queue or worker's saved list
+} Connection;
+
+//A server worker thread, with its own epoll instance (and its own
+//path finder in each snapshot). New connections are handed to
+//the workers in turn by the accepting thread. The save thread hands
+//back connections whose saves it has committed on the saved list,
+//and signals wakeFd (an eventfd in the worker's epoll set).
+typedef struct ServerWorker {
+	pthread_t tid;
+	int epfd;
+	int wakeFd;
+	int id;						//Index of the worker's path finders
+	Connection* connections;
+	Connection* saved;
+	pthread_mutex_t lock;		//Protects connections and saved
+} ServerWorker;
+
+//A session's "save" writes its checkpoint on the worker, but the
+//fdatasync() that commits it can take milliseconds, which would hold
+//up every other connection of that worker. So the connection is
+//taken out of the worker's epoll set and queued for one long-lived
+//save thread (see saveThread()), which commits each queued save in
+//turn and hands the connection back to its worker. The session's
+//reply, and any input it sent after "save", wait until then.
+typedef struct {
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t queued;		//Signalled when a save is queued
+	Connection* first;			//Queue of connections to commit
+	Connection* last;
+	int stop;
+} SaveService;
+
+static SaveService saveService;
+
+//Function run by the save thread: commit queued saves until stopped
+//(and the queue is empty).
+void* saveThread(void* arg){
+	
+	SaveService* ss = arg;
+	pthread_mutex_lock(&ss->lock);
+	for(;;){
+		while(ss->first == NULL && !ss->stop){
+			pthread_cond_wait(&ss->queued, &ss->lock);
+		}
+		if(ss->first == NULL){
+			break;
+		}
+		Connection* c = ss->first;
+		if((ss->first = c->nextSave) == NULL){
+			ss->last = NULL;
+		}
+		pthread_mutex_unlock(&ss->lock);
+		
+		commitCheckpoint(c->session.saving);
+		ServerWorker* w = c->worker;
+		pthread_mutex_lock(&w->lock);
+		c->nextSave = w->saved;
+		w->saved = c;
+		pthread_mutex_unlock(&w->lock);
+		uint64_t one = 1;
+		if(write(w->wakeFd, &one, sizeof(one)) == -1){
+			perror("Error waking server worker");
+		}
+		pthread_mutex_lock(&ss->lock);
+	}
+	pthread_mutex_unlock(&ss->lock);
+	return NULL;
+}
+
+//Function to start the save thread.
+void startSaveService(){
+	
+	SaveService* ss = &saveService;
+	ss->first = ss->last = NULL;
+	ss->stop = 0;
+	if(pthread_mutex_init(&ss->lock, NULL) != 0 || 
+	   pthread_cond_init(&ss->queued, NULL) != 0){
+		perror("Failed to establish mutext");
+		exit(EXIT_FAILURE);
+	}
+	if((pthread_create(&ss->tid, NULL, saveThread, ss)) != 0){
+		perror("Error creating thread");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Function to stop the save thread once it has committed every queued
+//save.
+void stopSaveService(){
+	
+	SaveService* ss = &saveService;
+	pthread_mutex_lock(&ss->lock);
+	ss->stop = 1;
+	pthread_cond_signal(&ss->queued);
+	pthread_mutex_unlock(&ss->lock);
+	pthread_join(ss->tid, NULL);
+	pthread_cond_destroy(&ss->queued);
+	pthread_mutex_destroy(&ss->lock);
+}
+
+//Function to stop watching connection c (whose session has a save
+//written) and queue its save for the save thread. Returns -1 if the
+//connection should be closed.
+int queueSave(ServerWorker* w, Connection* c){
+	
+	if(epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL) == -1){
+		return -1;
+	}
+	SaveService* ss = &saveService;
+	c->nextSave = NULL;
+	pthread_mutex_lock(&ss->lock);
+	if(ss->last != NULL){
+		ss->last->nextSave = c;
+	}
+	else{
+		ss->first = c;
+	}
+	ss->last = c;
+	pthread_cond_signal(&ss->queued);
+	pthread_mutex_unlock(&ss->lock);
+	return 0;
+}
+
+//Set by SIGINT/SIGTERM to shut the server down.
+static volatile sig_atomic_t serverStop = 0;
+
+void stopServer(int sig){
+	(void)sig;
+	serverStop = 1;
+}
+
+//Function to close a connection and free its session.
+void closeConnection(ServerWorker* w, Connection* c){
+	pthread_mutex_lock(&w->lock);
+	if(c->prev != NULL){
+		c->prev->next = c->next;
+	}
+	else{
+		w->connections = c->next;
+	}
+	if(c->next != NULL){
+		c->next->prev = c->prev;
+	}
+	pthread_mutex_unlock(&w->lock);
+	close(c->fd);
+	freeSession(&c->session);
+	freeBuffer(&c->out);
+	releaseSnapshot(c->snapshot);
+	free(c);
+}
+
+//Function to play each complete line of input held for a connection,
+//stopping early at a "save" (which is queued for the save thread) or
+//the end of the game (which is also where a session whose maze could
+//not be read ends). Returns -1 if the connection should be closed.
+int playInput(ServerWorker* w, Connection* c){
+	
+	const Maze* m = &c->snapshot->maze;
+	PathFinder* pf = &c->snapshot->finders[w->id];
+
+	size_t start = 0, k;
+	for(k = 0; k < c->inUsed && !c->done && c->session.saving == NULL; k++){
+		if(c->in[k] != '\n'){
+			continue;
+		}
+		c->in[k] = '\0';
+		int turn = takeTurn(m, &c->session, c->in + start, pf, &c->out);
+		start = k + 1;
+		if(turn == TURN_TIME){
+			char curTime[41];
+			requestTime(curTime);
+			appendTime(curTime, &c->out);
+		}
+		if(turn == TURN_SAVE){
+			//(The reply and prompt follow once it is committed.)
+			continue;
+		}
+		if(turn == TURN_DONE || turn == TURN_FAILED || 
+		   promptSession(m, &c->session, &c->out) == -1){
+			c->done = 1;
+		}
+	}
+	
+	//Keep the rest of the input for later.
+	memmove(c->in, c->in + start, c->inUsed - start);
+	c->inUsed -= start;
+	if(c->session.saving != NULL){
+		return queueSave(w, c);
+	}
+	if(c->inUsed == MAX_INPUT || c->out.used > MAX_PENDING){
+		return -1;
+	}
+	return 0;
+}
+
+//Function to read whatever input is waiting on a connection and play
+//each complete line. Returns -1 if the connection should be closed.
+int readConnection(ServerWorker* w, Connection* c){
+	
+	while(!c->done && c->session.saving == NULL){
+		ssize_t n = recv(c->fd, c->in + c->inUsed, MAX_INPUT - c->inUsed, 0);
+		if(n == 0){
+			return -1;
+		}
+		if(n < 0){
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		c->inUsed += n;
+		if(playInput(w, c) == -1){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//Function to take back a connection whose save the save thread has
+//committed: reply to the save, watch the connection again and play
+//any input that arrived after the "save". Returns -1 if the
+//connection should be closed.
+int resumeConnection(ServerWorker* w, Connection* c){
+	
+	finishSave(&c->session, &c->out);
+	if(promptSession(&c->snapshot->maze, &c->session, &c->out) == -1){
+		c->done = 1;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.ptr = c;
+	if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1){
+		return -1;
+	}
+	c->writing = 1;
+	return playInput(w, c);
+}
+
+//Function to write as much queued output as the socket will take,
+//watching for EPOLLOUT while some remains. Returns -1 if the
+//connection should be closed.
+int flushConnection(ServerWorker* w, Connection* c){
+	
+	//A connection waiting for its save belongs to the save thread
+	//until it is handed back (see resumeConnection()).
+	if(c->session.saving != NULL){
+		return 0;
+	}
+	while(c->outSent < c->out.used){
+		ssize_t n = send(c->fd, c->out.data + c->outSent, c->out.used - c->outSent, 
+			MSG_NOSIGNAL);
+		if(n < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				break;
+			}
+			return -1;
+		}
+		c->outSent += n;
+	}
+	if(c->outSent == c->out.used){
+		c->out.used = c->outSent = 0;
+		if(c->done){
+			return -1;
+		}
+	}
+
+	int writing = c->out.used > 0;
+	if(writing != c->writing){
+		struct epoll_event ev;
+		ev.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+		ev.data.ptr = c;
+		if(epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1){
+			return -1;
+		}
+		c->writing = writing;
+	}
+	return 0;
+}
+
+//Function run by each server worker: wait for events on the worker's
+//connections, play their input and write their output.
+void* serverWorker(void* arg){
+	
+	ServerWorker* w = arg;
+	struct epoll_event events[256];
+	while(!serverStop){
+		int n = epoll_wait(w->epfd, events, 256, 500);
+		int i;
+		for(i = 0; i < n; i++){
+			Connection* c = events[i].data.ptr;
+			if(c == NULL){
+				//Saves committed by the save thread.
+				uint64_t count;
+				if(read(w->wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN){
+					perror("Error reading server worker eventfd");
+				}
+				pthread_mutex_lock(&w->lock);
+				Connection* saved = w->saved;
+				w->saved = NULL;
+				pthread_mutex_unlock(&w->lock);
+				while((c = saved) != NULL){
+					saved = c->nextSave;
+					if(resumeConnection(w, c) == -1 || flushConnection(w, c) == -1){
+						closeConnection(w, c);
+					}
+				}
+				continue;
+			}
+			if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0 &&
+			   readConnection(w, c) == -1){
+				closeConnection(w, c);
+				continue;
+			}
+			if(flushConnection(w, c) == -1){
+				closeConnection(w, c);
+			}
+		}
+	}
+	return NULL;
+}
+
+//A newer maze loaded by the watcher thread (see watchMazes()) which
+//the accepting thread has not yet started serving, or NULL.
+static Snapshot* pendingSnapshot = NULL;
+
+//State of the thread watching for new mazes.
+typedef struct {
+	pthread_t tid;
+	int fd;						//inotify instance watching "."
+	LoadOptions lo;
+	int numWorkers;				//Path finders each snapshot needs
+	char dirName[256];			//Newest rooms directory seen
+	uint32_t generation;
+} MazeWatcher;
+
+//Function to load the maze in the newest rooms directory, if it is
+//not the one last seen, and hand it to the accepting thread. A maze
+//that fails to load is reported and skipped, and the server keeps
+//serving the maze it has. A paged maze has every shard read (and
+//checked) once first, as loading it only reads the header.
+void reloadMaze(MazeWatcher* mw){
+	
+	const char* dirName = newestDirectory();
+	if(dirName[0] == '\0' || strcmp(dirName, mw->dirName) == 0){
+		return;
+	}
+	snprintf(mw->dirName, sizeof(mw->dirName), "%s", dirName);
+
+	double start = now();
+	Snapshot* snap;
+	if((snap = newSnapshot(mw->numWorkers)) == NULL){
+		perror("Error allocating memory for maze");
+		return;
+	}
+	int loaded = loadDirectory(&snap->maze, mw->dirName, &mw->lo);
+	if(loaded == 0 && snap->maze.pager != NULL && checkShards(&snap->maze) == -1){
+		unloadMaze(&snap->maze);
+		loaded = -1;
+	}
+	if(loaded == -1){
+		fprintf(stderr, "Not serving %s: the maze could not be loaded\n", mw->dirName);
+		free(snap->finders);
+		free(snap);
+		return;
+	}
+	snap->generation = ++mw->generation;
+
+	//Replace any maze the accepting thread has not picked up yet.
+	Snapshot* old = __atomic_exchange_n(&pendingSnapshot, snap, __ATOMIC_ACQ_REL);
+	if(old != NULL){
+		releaseSnapshot(old);
+	}
+	fprintf(stderr, "Loaded %s: %u rooms in %.3f ms (generation %u)\n", mw->dirName,
+		snap->maze.numRooms, (now() - start) * 1e3, snap->generation);
+}
+
+//Function run by the watcher thread: wait for the manifest
+//LATEST_FILE_NAME to be replaced (fridkisb.buildrooms renames a new
+//one into place after every maze) and load the new maze.
+void* watchMazes(void* arg){
+	
+	MazeWatcher* mw = arg;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(!serverStop){
+		struct pollfd pfd = {mw->fd, POLLIN, 0};
+		if(poll(&pfd, 1, 500) <= 0){
+			continue;
+		}
+		ssize_t n = read(mw->fd, events, sizeof(events));
+		int changed = 0;
+		char* p;
+		for(p = events; n > 0 && p < events + n; ){
+			struct inotify_event* ev = (struct inotify_event*)p;
+			if(ev->len > 0 && strcmp(ev->name, LATEST_FILE_NAME) == 0){
+				changed = 1;
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+		if(changed){
+			reloadMaze(mw);
+		}
+	}
+	return NULL;
+}
+
+//Function to run the game server: listen on the Unix domain socket
+//socketPath, and play one session per client connection on the maze
+//m, which the server takes over (it is unloaded when the server
+//stops). Connections are spread over numWorkers worker threads, each
+//running its own nonblocking epoll loop. Clients play exactly as on
+//the terminal, sending one line per move. If watch is not NULL, m was
+//loaded from the rooms directory dirName, and each newer maze the
+//generator writes is loaded (as watch says) in the background and
+//served to new sessions, while sessions already playing finish on
+//the maze they started on. Runs until SIGINT or SIGTERM.
+void serve(Maze* m, const char* socketPath, int numWorkers, const char* dirName, 
+		const LoadOptions* watch){
+	
+	//Allow as many connections as the hard limit permits.
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "Socket path too long: %s\n", socketPath);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	int listenFd;
+	if((listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1){
+		perror("Error creating socket");
+		exit(EXIT_FAILURE);
+	}
+	unlink(socketPath);
+	if(bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || 
+	   listen(listenFd, SOMAXCONN) == -1){
+		perror(socketPath);
+		exit(EXIT_FAILURE);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stopServer;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ServerWorker* workers;
+	if((workers = calloc(numWorkers, sizeof(ServerWorker))) == NULL){
+		perror("Error allocating memory for server");
+		exit(EXIT_FAILURE);
+	}
+	int i;
+	startSaveService();
+	for(i = 0; i < numWorkers; i++){
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].lock, NULL);
+		struct epoll_event wev;
+		wev.events = EPOLLIN;
+		wev.data.ptr = NULL;
+		if((workers[i].epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 || 
+		   (workers[i].wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+		   epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, workers[i].wakeFd, &wev) == -1){
+			perror("Error creating epoll instance");
+			exit(EXIT_FAILURE);
+		}
+		if((pthread_create(&workers[i].tid, NULL, serverWorker, &workers[i])) != 0){
+			perror("Error creating thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	int epfd;
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 || 
+	   epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev) == -1){
+		perror("Error creating epoll instance");
+		exit(EXIT_FAILURE);
+	}
+
+	//The server holds a reference to the snapshot new sessions get.
+	Snapshot* current;
+	if((current = newSnapshot(numWorkers)) == NULL){
+		perror("Error allocating memory for maze");
+		exit(EXIT_FAILURE);
+	}
+	current->maze = *m;
+
+	MazeWatcher mw;
+	if(watch != NULL){
+		memset(&mw, 0, sizeof(mw));
+		mw.lo = *watch;
+		mw.numWorkers = numWorkers;
+		snprintf(mw.dirName, sizeof(mw.dirName), "%s", dirName);
+		if((mw.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ||
+		   inotify_add_watch(mw.fd, ".", IN_MOVED_TO | IN_CLOSE_WRITE) == -1){
+			perror("Error watching for new mazes");
+			exit(EXIT_FAILURE);
+		}
+		if((pthread_create(&mw.tid, NULL, watchMazes, &mw)) != 0){
+			perror("Error creating thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	fprintf(stderr, "Serving %u rooms on %s with %d worker(s)%s\n", m->numRooms, 
+		socketPath, numWorkers, watch != NULL ? ", watching for new mazes" : "");
+
+	//Accept connections, greet each with its first prompt and hand it
+	//to the next worker.
+	int nextWorker = 0;
+	while(!serverStop){
+		int ready = epoll_wait(epfd, &ev, 1, 500);
+
+		//Start serving a newly loaded maze. Sessions on the old one
+		//keep it until they close.
+		Snapshot* next = __atomic_exchange_n(&pendingSnapshot, NULL, __ATOMIC_ACQ_REL);
+		if(next != NULL){
+			releaseSnapshot(current);
+			current = next;
+		}
+		if(ready <= 0){
+			continue;
+		}
+		int fd;
+		while((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1){
+			Connection* c;
+			if((c = calloc(1, sizeof(Connection))) == NULL){
+				perror("Error allocating memory for connection");
+				exit(EXIT_FAILURE);
+			}
+			c->fd = fd;
+			c->snapshot = current;
+			c->worker = &workers[nextWorker];
+			holdSnapshot(current);
+			const Maze* cm = &current->maze;
+			initSession(&c->session, cm);
+			if(c->session.room == cm->endRoom){
+				finishSession(cm, &c->session, &c->out);
+				c->done = 1;
+			}
+			else if(promptSession(cm, &c->session, &c->out) == -1){
+				c->done = 1;
+			}
+			c->writing = 1;
+
+			ServerWorker* w = &workers[nextWorker];
+			nextWorker = (nextWorker + 1) % numWorkers;
+			pthread_mutex_lock(&w->lock);
+			c->next = w->connections;
+			if(c->next != NULL){
+				c->next->prev = c;
+			}
+			w->connections = c;
+			pthread_mutex_unlock(&w->lock);
+
+			struct epoll_event cev;
+			cev.events = EPOLLIN | EPOLLOUT;
+			cev.data.ptr = c;
+			if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &cev) == -1){
+				perror("Error adding connection");
+				closeConnection(w, c);
+			}
+		}
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			perror("Error accepting connection");
+		}
+	}
+
+	//Shut down: stop the watcher and the workers, let the save thread
+	//commit the saves it has queued, then close every connection.
+	if(watch != NULL){
+		pthread_join(mw.tid, NULL);
+		close(mw.fd);
+		if(pendingSnapshot != NULL){
+			releaseSnapshot(pendingSnapshot);
+		}
+	}
+	for(i = 0; i < numWorkers; i++){
+		pthread_join(workers[i].tid, NULL);
+	}
+	stopSaveService();
+	for(i = 0; i < numWorkers; i++){
+		while(workers[i].connections != NULL){
+			closeConnection(&workers[i], workers[i].connections);
+		}
+		close(workers[i].epfd);
+		close(workers[i].wakeFd);
+		pthread_mutex_destroy(&workers[i].lock);
+	}
+	releaseSnapshot(current);
+	free(workers);
+	close(epfd);
+	close(listenFd);
+	unlink(socketPath);
+}
+
+//Number of scripted sessions handed to a replay thread at a time.
+#define REPLAY_CHUNK 64
+
+//State shared by the replay threads (see replay()). Each script is the
+//text from scripts[i] up to the blank line (or end of input) after it.
+typedef struct {
+	const Maze* maze;
+	const char* input;
+	size_t inputSize;
+	size_t* scripts;			//Offset of each script in input
+	size_t numScripts;
+	size_t nextChunk;
+	Buffer* results;			//Output of each chunk of scripts
+	long inputs;				//Totals over all scripts
+	long moves;
+	long invalid;
+	long found;
+	pthread_mutex_t lock;		//Protects the totals
+} Replay;
+
+//Function to check whether the script line at line is blank, i.e.
+//holds nothing before its newline but an optional '\r'.
+int blankLine(const char* line, const char* end){
+	if(line < end && *line == '\r'){
+		line++;
+	}
+	return line == end || *line == '\n';
+}
+
+//Function to return the offset of the line after the one at pos.
+size_t nextLine(const char* input, size_t inputSize, size_t pos){
+	const char* eol = memchr(input + pos, '\n', inputSize - pos);
+	return eol == NULL ? inputSize : (size_t)(eol - input) + 1;
+}
+
+//Function run by every replay thread (including the main thread):
+//claim chunks of scripts and play each script as its own session,
+//writing one result line per script to the chunk's output buffer.
+void* replayWorker(void* arg){
+	
+	Replay* r = arg;
+	PathFinder pf;
+	pf.mark = NULL;
+	Buffer discard = {NULL, 0, 0};
+	long inputs = 0, moves = 0, invalid = 0, found = 0;
+	char move[MAX_INPUT + 1];
+	size_t numChunks = (r->numScripts + REPLAY_CHUNK - 1) / REPLAY_CHUNK;
+	size_t c;
+	while((c = __atomic_fetch_add(&r->nextChunk, 1, __ATOMIC_RELAXED)) < numChunks){
+		size_t k;
+		for(k = c * REPLAY_CHUNK; k < (c + 1) * REPLAY_CHUNK && k < r->numScripts; k++){
+			Session s;
+			initSession(&s, r->maze);
+			int turn = s.room == r->maze->endRoom ? TURN_DONE : TURN_OTHER;
+			const char* line = r->input + r->scripts[k];
+			const char* end = r->input + r->inputSize;
+			while(line < end && !blankLine(line, end) && turn != TURN_DONE && turn != TURN_FAILED){
+				const char* eol = memchr(line, '\n', end - line);
+				if(eol == NULL){
+					eol = end;
+				}
+				size_t len = eol - line;
+				if(len > 0 && line[len - 1] == '\r'){
+					len--;
+				}
+				memcpy(move, line, len);
+				move[len] = '\0';
+				
+				//Play the move with no prompts; its output is thrown away.
+				turn = takeTurn(r->maze, &s, move, &pf, &discard);
+				if(turn == TURN_TIME){
+					char curTime[41];
+					requestTime(curTime);
+				}
+				else if(turn == TURN_SAVE){
+					saveTurn(&s, &discard);
+				}
+				discard.used = 0;
+				inputs++;
+				if(turn == TURN_MOVED || turn == TURN_DONE){
+					moves++;
+				}
+				else if(turn == TURN_INVALID){
+					invalid++;
+				}
+				line = eol + 1;
+			}
+			found += turn == TURN_DONE;
+			printBuffer(&r->results[c], "%zu %s %zu %s\n", k + 1, 
+				turn == TURN_DONE ? "FOUND" : "LOST", pathLength(&s.path), 
+				roomName(r->maze, s.room));
+			freeSession(&s);
+		}
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->inputs += inputs;
+	r->moves += moves;
+	r->invalid += invalid;
+	r->found += found;
+	pthread_mutex_unlock(&r->lock);
+	
+	if(pf.mark != NULL){
+		freePathFinder(&pf);
+	}
+	freeBuffer(&discard);
+	return NULL;
+}
+
+//Function to play scripted sessions with no prompts (headless mode).
+//scriptFile ("-" for standard input) holds one move per line ('\r'
+//before the newline is ignored), and a blank line starts the next
+//session's script; every session starts in the START_ROOM. A line
+//longer than MAX_INPUT cannot be a move, so the script is rejected
+//(with the file and line) before anything is played. Sessions
+//are spread over numThreads threads, and one line per session
+//("<session> FOUND|LOST <steps> <final room>") is written to standard
+//output, in script order, by one buffered writer. Totals and moves
+//per second go to standard error.
+void replay(const Maze* m, const char* scriptFile, int numThreads){
+	
+	Replay r;
+	memset(&r, 0, sizeof(r));
+	r.maze = m;
+	pthread_mutex_init(&r.lock, NULL);
+
+	//Map the script file, or read standard input into memory.
+	void* map = NULL;
+	size_t mapSize = 0;
+	char* data = NULL;
+	if(strcmp(scriptFile, "-") != 0){
+		int fd;
+		struct stat fileAttributes;
+		if((fd = open(scriptFile, O_RDONLY)) == -1 || fstat(fd, &fileAttributes) == -1){
+			perror(scriptFile);
+			exit(EXIT_FAILURE);
+		}
+		mapSize = (size_t)fileAttributes.st_size;
+		if(mapSize > 0 && 
+		   (map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+			perror(scriptFile);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+		r.input = map;
+		r.inputSize = mapSize;
+	}
+	else{
+		Buffer in = {NULL, 0, 0};
+		ssize_t n;
+		do{
+			reserveBuffer(&in, 1 << 16);
+			if((n = read(STDIN_FILENO, in.data + in.used, in.size - in.used)) == -1){
+				perror("Error reading standard input");
+				exit(EXIT_FAILURE);
+			}
+			in.used += n;
+		}while(n > 0);
+		data = in.data;
+		r.input = data;
+		r.inputSize = in.used;
+	}
+
+	//Find where each script starts, and check that every line fits.
+	size_t scriptsSize = 1024, pos = 0, lineNo = 0;
+	if((r.scripts = malloc(scriptsSize * sizeof(size_t))) == NULL){
+		perror("Error allocating memory for scripts");
+		exit(EXIT_FAILURE);
+	}
+	const char* end = r.input + r.inputSize;
+	while(pos < r.inputSize){
+		//(Extra blank lines do not start empty scripts.)
+		if(blankLine(r.input + pos, end)){
+			pos = nextLine(r.input, r.inputSize, pos);
+			lineNo++;
+			continue;
+		}
+		if(r.numScripts == scriptsSize){
+			scriptsSize *= 2;
+			if((r.scripts = realloc(r.scripts, scriptsSize * sizeof(size_t))) == NULL){
+				perror("Error allocating memory for scripts");
+				exit(EXIT_FAILURE);
+			}
+		}
+		r.scripts[r.numScripts++] = pos;
+		while(pos < r.inputSize && !blankLine(r.input + pos, end)){
+			size_t next = nextLine(r.input, r.inputSize, pos);
+			size_t len = next - pos;
+			lineNo++;
+			if(len > 0 && r.input[next - 1] == '\n'){
+				len--;
+			}
+			if(len > 0 && r.input[pos + len - 1] == '\r'){
+				len--;
+			}
+			if(len > MAX_INPUT){
+				fprintf(stderr, "%s:%zu: line is longer than %d characters, so cannot be a move\n", 
+					strcmp(scriptFile, "-") == 0 ? "standard input" : scriptFile, lineNo, MAX_INPUT);
+				exit(EXIT_FAILURE);
+			}
+			pos = next;
+		}
+	}
+
+	size_t numChunks = (r.numScripts + REPLAY_CHUNK - 1) / REPLAY_CHUNK;
+	if((r.results = calloc(numChunks + 1, sizeof(Buffer))) == NULL){
+		perror("Error allocating memory for results");
+		exit(EXIT_FAILURE);
+	}
+	if(numThreads > (int)numChunks){
+		numThreads = numChunks > 0 ? (int)numChunks : 1;
+	}
+
+	double start = now();
+	pthread_t* tids;
+	if((tids = malloc(numThreads * sizeof(pthread_t))) == NULL){
+		perror("Error allocating memory for replay threads");
+		exit(EXIT_FAILURE);
+	}
+	int i;
+	for(i = 1; i < numThreads; i++){
+		if((pthread_create(&tids[i], NULL, replayWorker, &r)) != 0){
+			perror("Error creating thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	replayWorker(&r);
+	for(i = 1; i < numThreads; i++){
+		pthread_join(tids[i], NULL);
+	}
+	double elapsed = now() - start;
+
+	size_t c;
+	for(c = 0; c < numChunks; c++){
+		fwrite(r.results[c].data, 1, r.results[c].used, stdout);
+		freeBuffer(&r.results[c]);
+	}
+	fflush(stdout);
+	fprintf(stderr, "Played %zu sessions (%ld found the END_ROOM): %ld inputs, "
+		"%ld moves, %ld invalid in %.3f s (%.0f moves/s)\n", r.numScripts, r.found,
+		r.inputs, r.moves, r.invalid, elapsed, elapsed > 0 ? r.moves / elapsed : 0);
+
+	free(tids);
+	free(r.results);
+	free(r.scripts);
+	free(data);
+	if(map != NULL){
+		munmap(map, mapSize);
+	}
+	pthread_mutex_destroy(&r.lock);
+}
+
+//Comparison function for sorting timings (see printLatency()).
+int compareTimes(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+//Function to sort n timings (in seconds) and print their distribution,
+//as a line of text or (if json is set) as fields of a JSON object.
+void printLatency(double* times, int n, int json){
+	
+	qsort(times, n, sizeof(double), compareTimes);
+	double total = 0;
+	int i;
+	for(i = 0; i < n; i++){
+		total += times[i];
+	}
+	if(json){
+		printf("\"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f",
+			total / n * 1e6, times[n / 2] * 1e6, times[n * 99 / 100] * 1e6, times[n - 1] * 1e6);
+	}
+	else{
+		printf("Latency: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			total / n * 1e6, times[n / 2] * 1e6, times[n * 99 / 100] * 1e6, times[n - 1] * 1e6);
+	}
+}
+
+//Function to allocate room for n timings.
+double* allocTimes(int n){
+	double* times;
+	if((times = malloc(n * sizeof(double))) == NULL){
+		perror("Error allocating memory for benchmark");
+		exit(EXIT_FAILURE);
+	}
+	return times;
+}
+
+//Function to benchmark loadRooms() on the newest rooms directory,
+//comparing the serial path (1 thread) with numThreads threads.
+//Each is timed over several alternating rounds and the best and
+//mean times are printed.
+void benchLoad(int numThreads, int json){
+	
+	const int rounds = 5;
+	int threads[2] = {1, numThreads};
+	double best[2] = {1e30, 1e30}, total[2] = {0, 0};
+	uint32_t numRooms = 0;
+
+	setDirectory();
+	int r, k;
+	for(r = 0; r < rounds; r++){
+		for(k = 0; k < 2; k++){
+			Maze maze;
+			double start = now();
+			if(loadRooms(&maze, ".", threads[k]) == -1){
+				exit(EXIT_FAILURE);
+			}
+			double elapsed = now() - start;
+			numRooms = maze.numRooms;
+			unloadMaze(&maze);
+			total[k] += elapsed;
+			if(elapsed < best[k]){
+				best[k] = elapsed;
+			}
+		}
+	}
+	chdir("..");
+
+	if(json){
+		printf("{\"bench\": \"load\", \"rooms\": %u, \"rounds\": %d, \"threads\": %d, "
+			"\"serial_best_ms\": %.3f, \"serial_mean_ms\": %.3f, "
+			"\"parallel_best_ms\": %.3f, \"parallel_mean_ms\": %.3f, \"speedup\": %.3f}\n",
+			numRooms, rounds, numThreads, best[0] * 1e3, total[0] / rounds * 1e3,
+			best[1] * 1e3, total[1] / rounds * 1e3, best[0] / best[1]);
+		return;
+	}
+	printf("Loaded %u rooms, %d rounds\n", numRooms, rounds);
+	for(k = 0; k < 2; k++){
+		printf("%2d thread(s): best %.3f ms, mean %.3f ms\n", threads[k], 
+			best[k] * 1e3, total[k] / rounds * 1e3);
+	}
+	printf("Speedup: %.2fx\n", best[0] / best[1]);
+}
+
+//Function to benchmark setDirectory(): time finding (and entering)
+//the newest rooms directory from the current directory, which uses
+//the manifest if there is one and otherwise scans every entry.
+void benchDiscover(int json){
+	
+	const int rounds = 1000;
+	double* times = allocTimes(rounds);
+	int manifest = access(LATEST_FILE_NAME, R_OK) == 0;
+	int r;
+	for(r = 0; r < rounds; r++){
+		double start = now();
+		setDirectory();
+		times[r] = now() - start;
+		chdir("..");
+	}
+
+	if(json){
+		printf("{\"bench\": \"discover\", \"manifest\": %s, \"count\": %d, ", 
+			manifest ? "true" : "false", rounds);
+		printLatency(times, rounds, json);
+		printf("}\n");
+	}
+	else{
+		printf("Found the newest rooms directory %d times (%s)\n", rounds, 
+			manifest ? "manifest" : "directory scan");
+		printLatency(times, rounds, json);
+	}
+	free(times);
+}
+
+//Function to benchmark the "time" command: time the round trip of
+//requests to the time thread (which does not write currentTime.txt
+//unless persist is set).
+void benchTime(int persist, int json){
+	
+	const int requests = 10000;
+	double* times = allocTimes(requests);
+	startTimeService(persist);
+	int r;
+	for(r = 0; r < requests; r++){
+		char curTime[41];
+		double start = now();
+		requestTime(curTime);
+		times[r] = now() - start;
+	}
+	stopTimeService();
+
+	if(json){
+		printf("{\"bench\": \"time\", \"persist\": %s, \"count\": %d, ", 
+			persist ? "true" : "false", requests);
+		printLatency(times, requests, json);
+		printf("}\n");
+	}
+	else{
+		printf("Answered %d time requests\n", requests);
+		printLatency(times, requests, json);
+	}
+	free(times);
+}
+
+//Function to benchmark moves in maze m the way the game loop makes
+//them: each move is a prompt followed by takeTurn() with the name of a
+//random connection. A session that reaches the END_ROOM is finished
+//and a new one started.
+void benchMoves(const Maze* m, int json){
+	
+	const int moves = 100000;
+	double* times = allocTimes(moves);
+	Session s;
+	initSession(&s, m);
+	PathFinder pf;
+	pf.mark = NULL;
+	Buffer out = {NULL, 0, 0};
+
+	srand(1);
+	int finished = 0, i;
+	char name[256];
+	for(i = 0; i < moves; i++){
+		//The name is copied, as a paged room's name does not outlive
+		//the prompt.
+		uint32_t degree;
+		const uint32_t* links = roomLinks(m, s.room, &degree);
+		snprintf(name, sizeof(name), "%s", degree == 0 ? "" : 
+			roomName(m, links[(uint32_t)rand() % degree]));
+		double start = now();
+		promptSession(m, &s, &out);
+		int turn = takeTurn(m, &s, name, &pf, &out);
+		times[i] = now() - start;
+		out.used = 0;
+		if(turn == TURN_FAILED){
+			break;
+		}
+		if(turn == TURN_DONE){
+			finished++;
+			freeSession(&s);
+			initSession(&s, m);
+		}
+	}
+
+	//Nothing is reported if the maze could not be read.
+	if(i == moves && json){
+		printf("{\"bench\": \"moves\", \"rooms\": %u, \"count\": %d, \"finished\": %d, ", 
+			m->numRooms, moves, finished);
+		printLatency(times, moves, json);
+		printf("}\n");
+	}
+	else if(i == moves){
+		printf("Rooms: %u, %d moves (%d sessions finished)\n", m->numRooms, moves, finished);
+		printLatency(times, moves, json);
+	}
+
+	freeSession(&s);
+	freeBuffer(&out);
+	if(pf.mark != NULL){
+		freePathFinder(&pf);
+	}
+	free(times);
+}
+
+//Function to benchmark findPath() on maze m: time queries from random
+//rooms to the END_ROOM and print the latency distribution along with
+//the size of the maze.
+void benchSolve(const Maze* m, int json){
+	
+	const int queries = 1000;
+	double* times = allocTimes(queries);
+	PathFinder pf;
+	initPathFinder(&pf, m);
+
+	srand(1);
+	long steps = 0;
+	int q;
+	for(q = 0; q < queries; q++){
+		uint32_t from = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % m->numRooms);
+		double start = now();
+		int len = findPath(&pf, m, from, m->endRoom);
+		times[q] = now() - start;
+		steps += len > 0 ? len : 0;
+	}
+
+	if(json){
+		printf("{\"bench\": \"solve\", \"rooms\": %u, \"connections\": %u, \"count\": %d, "
+			"\"mean_steps\": %.2f, ", m->numRooms, numConnections(m), queries, 
+			(double)steps / queries);
+		printLatency(times, queries, json);
+		printf("}\n");
+	}
+	else{
+		printf("Rooms: %u, connections: %u, %d queries\n", m->numRooms, 
+			numConnections(m), queries);
+		printf("Mean path length: %.2f steps\n", (double)steps / queries);
+		printLatency(times, queries, json);
+	}
+
+	freePathFinder(&pf);
+	free(times);
+}
+
+//Function to print the shortest path from the START_ROOM to the
+//END_ROOM of maze m. Returns 0 if there is one (and the rooms could
+//all be read).
+int solve(const Maze* m){
+	
+	PathFinder pf;
+	initPathFinder(&pf, m);
+	int len = findPath(&pf, m, m->startRoom, m->endRoom);
+	if(mazeErrors(m) != 0){
+		freePathFinder(&pf);
+		return 1;
+	}
+	if(len < 0){
+		printf("THERE IS NO PATH FROM %s TO %s.\n", 
+			roomName(m, m->startRoom), roomName(m, m->endRoom));
+	}
+	else{
+		printf("THE SHORTEST PATH FROM %s TO %s TAKES %d STEPS:\n",
+			roomName(m, m->startRoom), roomName(m, m->endRoom), len);
+		int i;
+		for(i = 0; i < len; i++){
+			printf("%s\n", roomName(m, pf.route[i]));
+		}
+	}
+	freePathFinder(&pf);
+	return len < 0 || mazeErrors(m) != 0;
+}
+
+//Step counts below HIST_EXACT are counted exactly by a StepHistogram.
+//Above that, every power of two is split into HIST_SUB buckets, so a
+//bucket is never wider than 1/HIST_SUB of the counts in it.
+#define HIST_EXACT 64
+#define HIST_SUB 32
+#define HIST_BUCKETS (HIST_EXACT + 26 * HIST_SUB)
+
+//Distribution of the steps simulated walks took to reach the END_ROOM
+//(see simulate()). Histograms of separate threads are merged by adding
+//them up.
+typedef struct {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t walks;				//Walks simulated
+	uint64_t found;				//Walks which reached the END_ROOM
+	uint64_t totalSteps;		//Steps of the walks which did
+	uint32_t maxSteps;			//Longest of them
+} StepHistogram;
+
+//Function to return the bucket counting walks of the given steps.
+uint32_t histBucket(uint32_t steps){
+	if(steps < HIST_EXACT){
+		return steps;
+	}
+	int b = 31 - __builtin_clz(steps);		//steps is in [2^b, 2^(b+1))
+	return HIST_EXACT + (b - 6) * HIST_SUB + ((steps >> (b - 5)) & (HIST_SUB - 1));
+}
+
+//Function to return the largest step count in a bucket.
+uint32_t histBucketMax(uint32_t bucket){
+	if(bucket < HIST_EXACT){
+		return bucket;
+	}
+	uint32_t b = (bucket - HIST_EXACT) / HIST_SUB + 6;
+	uint64_t sub = (bucket - HIST_EXACT) % HIST_SUB;
+	return (uint32_t)((((HIST_SUB + sub + 1) << (b - 5))) - 1);
+}
+
+//Function to add the walks counted in src to dst.
+void mergeHistogram(StepHistogram* dst, const StepHistogram* src){
+	uint32_t i;
+	for(i = 0; i < HIST_BUCKETS; i++){
+		dst->counts[i] += src->counts[i];
+	}
+	dst->walks += src->walks;
+	dst->found += src->found;
+	dst->totalSteps += src->totalSteps;
+	if(src->maxSteps > dst->maxSteps){
+		dst->maxSteps = src->maxSteps;
+	}
+}
+
+//Function to return the steps within which the fraction q of all
+//walks reached the END_ROOM (the largest step count of the bucket it
+//falls in, at most the longest walk), or -1 if that many did not.
+long histPercentile(const StepHistogram* h, double q){
+	uint64_t rank = (uint64_t)(q * h->walks);
+	if(rank >= h->walks){
+		rank = h->walks - 1;
+	}
+	if(rank >= h->found){
+		return -1;
+	}
+	uint64_t seen = 0;
+	uint32_t i;
+	for(i = 0; i < HIST_BUCKETS; i++){
+		seen += h->counts[i];
+		if(seen > rank){
+			break;
+		}
+	}
+	uint32_t steps = histBucketMax(i);
+	return steps < h->maxSteps ? steps : h->maxSteps;
+}
+
+//Walks handed to a simulator thread at a time.
+#define SIM_CHUNK 1024
+
+//Random walks a simulator thread plays at once, taking one step of
+//each in turn, so that the cache misses of their next rooms overlap
+//instead of each waiting for the last.
+#define SIM_LANES 8
+
+//How a simulated player picks its next room: any connection at
+//random, or (greedy) a random one of those it has not been in yet on
+//this walk, if there are any.
+enum { WALK_RANDOM, WALK_GREEDY };
+
+//State shared by the simulator threads (see simulate()).
+typedef struct {
+	const Maze* maze;
+	uint64_t numWalks;
+	uint64_t nextChunk;
+	uint64_t seed;
+	uint32_t maxSteps;
+	int policy;
+	StepHistogram total;
+	pthread_mutex_t lock;		//Protects total
+} Simulator;
+
+//A walk in progress on a simulator thread.
+typedef struct {
+	uint64_t rng;				//State of the walk's random stream
+	uint32_t room;
+	uint32_t steps;
+} Walker;
+
+//Function to return the next number of a splitmix64 random stream.
+uint64_t nextRandom(uint64_t* state){
+	*state += 0x9E3779B97F4A7C15ULL;
+	uint64_t x = *state;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+//Function to return a random number below n from a walk's stream.
+uint32_t randomBelow(Walker* w, uint32_t n){
+	return (uint32_t)(((nextRandom(&w->rng) >> 32) * n) >> 32);
+}
+
+//Function run by every simulator thread (including the main thread):
+//claim chunks of walks, play each from the START_ROOM until it reaches
+//the END_ROOM or takes maxSteps steps, and count it in the thread's
+//own histogram, which is merged into the total at the end. Every walk
+//has its own random stream (from the seed and the walk's number), so
+//the results do not depend on the number of threads. Random walks
+//are played SIM_LANES at a time; greedy ones one at a time, as each
+//needs its own record of the rooms it has visited.
+void* simulateWorker(void* arg){
+	
+	Simulator* sim = arg;
+	const Maze* m = sim->maze;
+	StepHistogram* h;
+	if((h = calloc(1, sizeof(StepHistogram))) == NULL){
+		perror("Error allocating memory for simulation");
+		exit(EXIT_FAILURE);
+	}
+	//For the greedy player, the walk each room was last visited on.
+	uint32_t* visited = NULL;
+	uint32_t stamp = 0;
+	if(sim->policy == WALK_GREEDY && 
+	   (visited = calloc(m->numRooms, sizeof(uint32_t))) == NULL){
+		perror("Error allocating memory for simulation");
+		exit(EXIT_FAILURE);
+	}
+
+	Walker lanes[SIM_LANES];
+	int numLanes = visited != NULL ? 1 : SIM_LANES;
+	int active = 0, j;
+	uint64_t numChunks = (sim->numWalks + SIM_CHUNK - 1) / SIM_CHUNK;
+	uint64_t next = 0, last = 0;		//Walks claimed but not started
+	while(mazeErrors(m) == 0){
+		//Start new walks in the free lanes.
+		while(active < numLanes){
+			if(next == last){
+				uint64_t c = __atomic_fetch_add(&sim->nextChunk, 1, __ATOMIC_RELAXED);
+				if(c >= numChunks){
+					break;
+				}
+				next = c * SIM_CHUNK;
+				last = next + SIM_CHUNK < sim->numWalks ? next + SIM_CHUNK : sim->numWalks;
+			}
+			Walker* w = &lanes[active++];
+			w->rng = mix64(sim->seed ^ mix64(++next));
+			w->room = m->startRoom;
+			w->steps = 0;
+			if(visited != NULL && ++stamp == 0){
+				memset(visited, 0, m->numRooms * sizeof(uint32_t));
+				stamp = 1;
+			}
+		}
+		if(active == 0){
+			break;
+		}
+
+		//Take a step of every walk, counting (and dropping) the ones
+		//which have ended.
+		for(j = 0; j < active; ){
+			Walker* w = &lanes[j];
+			uint32_t degree = 0;
+			const uint32_t* links = NULL;
+			if(w->room != m->endRoom && w->steps < sim->maxSteps){
+				links = roomLinks(m, w->room, &degree);
+			}
+			if(degree == 0){
+				h->walks++;
+				if(w->room == m->endRoom){
+					h->found++;
+					h->totalSteps += w->steps;
+					h->counts[histBucket(w->steps)]++;
+					if(w->steps > h->maxSteps){
+						h->maxSteps = w->steps;
+					}
+				}
+				lanes[j] = lanes[--active];
+				continue;
+			}
+
+			//Count the connections not yet visited on this walk.
+			uint32_t fresh = 0, i;
+			if(visited != NULL){
+				visited[w->room] = stamp;
+				for(i = 0; i < degree; i++){
+					fresh += visited[links[i]] != stamp;
+				}
+			}
+			if(fresh > 0){
+				uint32_t pick = randomBelow(w, fresh);
+				for(i = 0; visited[links[i]] == stamp || pick > 0; i++){
+					if(visited[links[i]] != stamp){
+						pick--;
+					}
+				}
+			}
+			else{
+				i = randomBelow(w, degree);
+			}
+			w->room = links[i];
+			w->steps++;
+			j++;
+		}
+	}
+
+	pthread_mutex_lock(&sim->lock);
+	mergeHistogram(&sim->total, h);
+	pthread_mutex_unlock(&sim->lock);
+	free(visited);
+	free(h);
+	return NULL;
+}
+
+//Function to simulate numWalks walks through maze m by players
+//following policy (see WALK_RANDOM), spread over numThreads threads,
+//and print how many steps they took to reach the END_ROOM: the mean,
+//percentiles and tail of the distribution, and how many gave up after
+//maxSteps steps. Percentiles are within 1/HIST_SUB of the exact step
+//counts. Nothing is printed if a paged maze could not read a room.
+void simulate(const Maze* m, uint64_t numWalks, int policy, uint32_t maxSteps,
+		uint64_t seed, int numThreads, int json){
+	
+	Simulator sim;
+	memset(&sim, 0, sizeof(sim));
+	sim.maze = m;
+	sim.numWalks = numWalks;
+	sim.seed = seed;
+	sim.maxSteps = maxSteps;
+	sim.policy = policy;
+	pthread_mutex_init(&sim.lock, NULL);
+
+	double start = now();
+	uint64_t numChunks = (numWalks + SIM_CHUNK - 1) / SIM_CHUNK;
+	if((uint64_t)numThreads > numChunks){
+		numThreads = (int)numChunks;
+	}
+	pthread_t* tids;
+	if((tids = malloc(numThreads * sizeof(pthread_t))) == NULL){
+		perror("Error allocating memory for threads");
+		exit(EXIT_FAILURE);
+	}
+	int i;
+	for(i = 1; i < numThreads; i++){
+		if((pthread_create(&tids[i], NULL, simulateWorker, &sim)) != 0){
+			perror("Error creating thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	simulateWorker(&sim);
+	for(i = 1; i < numThreads; i++){
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	pthread_mutex_destroy(&sim.lock);
+	double elapsed = now() - start;
+	if(mazeErrors(m) != 0){
+		return;
+	}
+
+	const StepHistogram* h = &sim.total;
+	const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+	const char* names[4] = {"p50", "p90", "p99", "p999"};
+	const char* policyName = policy == WALK_GREEDY ? "greedy" : "random";
+	double mean = h->found > 0 ? (double)h->totalSteps / h->found : 0;
+	if(json){
+		printf("{\"simulate\": \"%s\", \"rooms\": %u, \"walks\": %llu, \"max_steps\": %u, "
+			"\"found\": %llu, \"lost\": %llu, \"mean_steps\": %.2f", policyName, m->numRooms,
+			(unsigned long long)h->walks, maxSteps, (unsigned long long)h->found, 
+			(unsigned long long)(h->walks - h->found), mean);
+		for(i = 0; i < 4; i++){
+			long steps = histPercentile(h, quantiles[i]);
+			if(steps < 0){
+				printf(", \"%s_steps\": null", names[i]);
+			}
+			else{
+				printf(", \"%s_steps\": %ld", names[i], steps);
+			}
+		}
+		printf(", \"longest_steps\": %u, \"threads\": %d, \"seconds\": %.3f}\n", 
+			h->maxSteps, numThreads, elapsed);
+	}
+	else{
+		printf("Simulated %llu %s walks on %u rooms in %.3f s (%d thread(s))\n",
+			(unsigned long long)h->walks, policyName, m->numRooms, elapsed, numThreads);
+		printf("Reached the END_ROOM: %llu (%.2f%%), gave up after %u steps: %llu\n",
+			(unsigned long long)h->found, 100.0 * h->found / h->walks, maxSteps, 
+			(unsigned long long)(h->walks - h->found));
+		printf("Steps to the END_ROOM: mean %.2f (of the walks which reached it)", mean);
+		for(i = 0; i < 4; i++){
+			long steps = histPercentile(h, quantiles[i]);
+			if(steps < 0){
+				printf(", %s >%u", names[i], maxSteps);
+			}
+			else{
+				printf(", %s %ld", names[i], steps);
+			}
+		}
+		printf(", max %u\n", h->maxSteps);
+	}
+}
+
+//Function to print usage information and exit.
+void usage(char* prog){
+	fprintf(stderr, "Usage: %s [--maze <file>|--maze-fd N] [--threads N] [--no-time-file] [--path-spill N]\n"
+		"          [--solve] [--stats] [--stats-file <file>] [--no-builtin] [--no-validate]\n"
+		"          [--resume <file>]\n"
+		"          [--page-cache N [--shard-rooms K] [--prefetch]]\n"
+		"       %s [--maze <file>] --compile <file.c>\n"
+		"       %s [--maze <file>] [--threads N] [--no-time-file] [--json] --bench-load|--bench-solve|\n"
+		"          --bench-moves|--bench-time|--bench-discover ...\n"
+		"       %s [--maze <file>] [--threads N] [--json] --simulate N [--policy random|greedy]\n"
+		"          [--max-steps S] [--seed S]\n"
+		"       %s [--maze <file>] [--threads N] --server <socket> [--watch]\n"
+		"       %s [--maze <file>] [--threads N] --script <file>|-\n", prog, prog, prog, prog, prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+//Function to convert the option argument argv[i] to a number from min
+//to max, exiting with a usage message if it is missing, malformed or
+//out of range.
+uint64_t parseNumber(int argc, char* argv[], int i, uint64_t min, uint64_t max){
+	if(i >= argc){
+		usage(argv[0]);
+	}
+	char* end;
+	errno = 0;
+	unsigned long long n = strtoull(argv[i], &end, 10);
+	if(errno != 0 || *end != '\0' || argv[i][0] == '-' || end == argv[i]){
+		fprintf(stderr, "Invalid number for %s: %s\n", argv[i - 1], argv[i]);
+		usage(argv[0]);
+	}
+	if(n < min || n > max){
+		fprintf(stderr, "%s must be between %llu and %llu\n", argv[i - 1], 
+			(unsigned long long)min, (unsigned long long)max);
+		usage(argv[0]);
+	}
+	return n;
+}
+
+int main(int argc, char* argv[]){
+	
+	//Maze file given with --maze, or descriptor a maze is streamed on
+	//with --maze-fd (if any)
+	char* mazeFile = NULL;
+	int mazeFd = -1;
+	//Threads used to load room files (one per CPU by default)
+	int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	//Benchmarks to run instead of playing (see bench*()), and whether
+	//their results are printed as JSON (one object per line)
+	int bench = 0, benchPaths = 0, benchTurns = 0, benchTimes = 0, benchDirs = 0, json = 0;
+	int solveOnly = 0;
+	//Socket to serve sessions on, and whether to serve new mazes as
+	//they are generated (see serve())
+	char* socketPath = NULL;
+	int watch = 0;
+	//Scripted sessions to play headless (see replay())
+	char* scriptFile = NULL;
+	//Whether the "time" command also writes currentTime.txt
+	int persistTime = 1;
+	//Where --stats are printed (stderr if NULL)
+	char* statsFile = NULL;
+	//C file to compile the maze into (see compileMaze()), and whether
+	//to ignore a compiled in maze
+	char* compileFile = NULL;
+	int noBuiltin = 0;
+	//Checkpoint to continue the game from (see resumeSession())
+	char* resumeFile = NULL;
+	//Shards of a paged maze to cache (0 maps the whole maze file
+	//instead), rooms per shard, and whether to read ahead (see pageMaze())
+	unsigned long pageCache = 0, shardRooms = 64;
+	int prefetch = 0;
+	//Walks to simulate instead of playing, how each picks its moves,
+	//the steps after which it gives up, and the random seed (see
+	//simulate())
+	unsigned long long numWalks = 0, seed = 1;
+	int policy = WALK_RANDOM;
+	unsigned long maxSteps = 1000000;
+	int i;
+	for(i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--maze") == 0 && i + 1 < argc){
+			mazeFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--maze-fd") == 0){
+			mazeFd = (int)parseNumber(argc, argv, ++i, 0, INT32_MAX);
+		}
+		else if(strcmp(argv[i], "--threads") == 0){
+			numThreads = (int)parseNumber(argc, argv, ++i, 1, 1024);
+		}
+		else if(strcmp(argv[i], "--bench-load") == 0){
+			bench = 1;
+		}
+		else if(strcmp(argv[i], "--solve") == 0){
+			solveOnly = 1;
+		}
+		else if(strcmp(argv[i], "--bench-solve") == 0){
+			benchPaths = 1;
+		}
+		else if(strcmp(argv[i], "--bench-moves") == 0){
+			benchTurns = 1;
+		}
+		else if(strcmp(argv[i], "--bench-time") == 0){
+			benchTimes = 1;
+		}
+		else if(strcmp(argv[i], "--bench-discover") == 0){
+			benchDirs = 1;
+		}
+		else if(strcmp(argv[i], "--json") == 0){
+			json = 1;
+		}
+		else if(strcmp(argv[i], "--stats") == 0){
+			stats.enabled = 1;
+		}
+		else if(strcmp(argv[i], "--compile") == 0 && i + 1 < argc){
+			compileFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--no-builtin") == 0){
+			noBuiltin = 1;
+		}
+		else if(strcmp(argv[i], "--no-validate") == 0){
+			validateMazes = 0;
+		}
+		else if(strcmp(argv[i], "--resume") == 0 && i + 1 < argc){
+			resumeFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--simulate") == 0){
+			numWalks = parseNumber(argc, argv, ++i, 1, UINT64_MAX);
+		}
+		else if(strcmp(argv[i], "--policy") == 0 && i + 1 < argc){
+			i++;
+			if(strcmp(argv[i], "random") == 0){
+				policy = WALK_RANDOM;
+			}
+			else if(strcmp(argv[i], "greedy") == 0){
+				policy = WALK_GREEDY;
+			}
+			else{
+				usage(argv[0]);
+			}
+		}
+		else if(strcmp(argv[i], "--max-steps") == 0){
+			maxSteps = parseNumber(argc, argv, ++i, 1, UINT32_MAX);
+		}
+		else if(strcmp(argv[i], "--seed") == 0){
+			seed = parseNumber(argc, argv, ++i, 0, UINT64_MAX);
+		}
+		else if(strcmp(argv[i], "--page-cache") == 0){
+			pageCache = parseNumber(argc, argv, ++i, 1, UINT32_MAX);
+		}
+		else if(strcmp(argv[i], "--shard-rooms") == 0){
+			shardRooms = parseNumber(argc, argv, ++i, 1, 1UL << 24);
+		}
+		else if(strcmp(argv[i], "--prefetch") == 0){
+			prefetch = 1;
+		}
+		else if(strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc){
+			stats.enabled = 1;
+			statsFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--server") == 0 && i + 1 < argc){
+			socketPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--watch") == 0){
+			watch = 1;
+		}
+		else if(strcmp(argv[i], "--script") == 0 && i + 1 < argc){
+			scriptFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--no-time-file") == 0){
+			persistTime = 0;
+		}
+		else if(strcmp(argv[i], "--path-spill") == 0){
+			pathSpillLimit = parseNumber(argc, argv, ++i, 16, SIZE_MAX);
+		}
+		else{
+			usage(argv[0]);
+		}
+	}
+	if(numThreads < 1){
+		numThreads = 1;
+	}
+	//A paged maze reads rooms into a cache shared by everything
+	//using the maze, so it is played on one thread, and cannot be
+	//compiled (which needs the whole maze in memory).
+	if(pageCache > 0){
+		numThreads = 1;
+		if(compileFile != NULL){
+			usage(argv[0]);
+		}
+	}
+	//Only a server loading the newest rooms directory can watch for
+	//newer ones.
+	if(watch && (socketPath == NULL || mazeFile != NULL || mazeFd != -1)){
+		usage(argv[0]);
+	}
+	//A streamed maze is read whole, so it cannot be paged.
+	if(mazeFd != -1 && (mazeFile != NULL || pageCache > 0)){
+		usage(argv[0]);
+	}
+	LoadOptions lo = {numThreads, (uint32_t)pageCache, (uint32_t)shardRooms, prefetch};
+
+	//Benchmarks which do not need a loaded maze
+	if(benchDirs){
+		benchDiscover(json);
+	}
+	if(benchTimes){
+		benchTime(persistTime, json);
+	}
+	if(bench){
+		benchLoad(numThreads, json);
+	}
+	if((bench || benchDirs || benchTimes) && !benchPaths && !benchTurns){
+		return 0;
+	}
+
+	Maze maze;
+	memset(&maze, 0, sizeof(maze));
+	const char* dirName = "";
+	double start = now();
+	int loaded = 0;
+	if(mazeFd != -1){
+		loaded = streamMaze(mazeFd, &maze);
+	}
+	else if(mazeFile != NULL && pageCache > 0){
+		loaded = pageMaze(mazeFile, &maze, (uint32_t)pageCache, (uint32_t)shardRooms, prefetch);
+	}
+	else if(mazeFile != NULL){
+		loaded = mapMaze(mazeFile, &maze);
+	}
+	else if(&builtinMaze != NULL && !noBuiltin && compileFile == NULL && !watch){
+		//Play the maze compiled into the program.
+		loadBuiltin(&maze, &builtinMaze);
+	}
+	else{
+		//Find the newest rooms directory, then load the maze in it.
+		dirName = newestDirectory();
+		stats.discover = now() - start;
+		start = now();
+		loaded = loadDirectory(&maze, dirName, &lo);
+	}
+	if(loaded == -1){
+		exit(EXIT_FAILURE);
+	}
+	stats.load = now() - start;
+	start = now();
+
+	//Write the maze out as C source instead of playing.
+	if(compileFile != NULL){
+		compileMaze(&maze, compileFile);
+		unloadMaze(&maze);
+		return 0;
+	}
+	
+	//Print the optimal route (or benchmark route finding and moves)
+	//instead of playing.
+	if(solveOnly || benchPaths || benchTurns || numWalks > 0){
+		int status = solveOnly ? solve(&maze) : 0;
+		if(numWalks > 0){
+			simulate(&maze, numWalks, policy, (uint32_t)maxSteps, seed, numThreads, json);
+		}
+		if(benchPaths){
+			benchSolve(&maze, json);
+		}
+		if(benchTurns){
+			benchMoves(&maze, json);
+		}
+		//(A paged maze which could not read a room has reported it.)
+		status |= mazeErrors(&maze) != 0;
+		if(stats.enabled){
+			stats.play = now() - start;
+			printStats(statsFile);
+		}
+		unloadMaze(&maze);
+		return status ? EXIT_FAILURE : 0;
+	}
+
+	//Start the thread that answers the "time" command.
+	startTimeService(persistTime);
+
+	//Serve many players the same maze instead of playing here. The
+	//server unloads the maze itself.
+	if(socketPath != NULL){
+		serve(&maze, socketPath, numThreads, dirName, watch ? &lo : NULL);
+		stopTimeService();
+		if(stats.enabled){
+			stats.play = now() - start;
+			printStats(statsFile);
+		}
+		return 0;
+	}
+
+	//Play scripted sessions without prompts.
+	if(scriptFile != NULL){
+		replay(&maze, scriptFile, numThreads);
+		stopTimeService();
+		if(stats.enabled){
+			stats.play = now() - start;
+			printStats(statsFile);
+		}
+		unloadMaze(&maze);
+		return 0;
+	}
+
+	//Start the player in the starting room. Their path (the series of
+	//rooms visited) is kept in the session.
+	Session session;
+	initSession(&session, &maze);
+	if(resumeFile != NULL){
+		const char* problem = resumeSession(&maze, &session, resumeFile);
+		if(problem != NULL){
+			fprintf(stderr, "%s: %s\n", resumeFile, problem);
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	//Buffers for the "hint" command, allocated on first use.
+	PathFinder pf;
+	pf.mark = NULL;
+
+	//Output for each turn is composed here, then printed. Input is
+	//read in chunks into in, which is reused for the whole game, and
+	//every complete line already read is played before the output is
+	//written. A player typing gets each response as before, while
+	//moves piped in many to a read are answered with a single write.
+	Buffer out = {NULL, 0, 0};
+	Buffer in = {NULL, 0, 0};
+	size_t lineStart = 0;
+	int eof = 0;
+
+	//Prompt user to navigate to a current room connection
+	//until user reaches end room!
+	int turn = session.room == maze.endRoom ? TURN_DONE : TURN_OTHER;
+	if(turn == TURN_DONE){
+		finishSession(&maze, &session, &out);
+	}
+	else if(promptSession(&maze, &session, &out) == -1){
+		turn = TURN_FAILED;
+	}
+	while(turn != TURN_DONE && turn != TURN_FAILED){
+		
+		//Get user input: the next line if one has been read,
+		//otherwise print the output so far and read some more.
+		char* eol = in.used > lineStart ? 
+			memchr(in.data + lineStart, '\n', in.used - lineStart) : NULL;
+		if(eol == NULL){
+			if(eof){
+				break;
+			}
+			writeBuffer(&out, STDOUT_FILENO);
+			if(lineStart > 0){
+				memmove(in.data, in.data + lineStart, in.used - lineStart);
+				in.used -= lineStart;
+				lineStart = 0;
+			}
+			reserveBuffer(&in, 4096);
+			ssize_t n = read(STDIN_FILENO, in.data + in.used, in.size - in.used);
+			if(n == -1 && errno == EINTR){
+				continue;
+			}
+			countStat(&stats.syscalls, 1);
+			if(n <= 0){
+				//Play an unterminated last line, then stop.
+				eof = 1;
+				if(in.used > 0){
+					in.data[in.used++] = '\n';
+				}
+				continue;
+			}
+			countStat(&stats.bytesRead, n);
+			in.used += n;
+			continue;
+		}
+		//Strip trailing newline from user input
+		*eol = '\0';
+		char* input = in.data + lineStart;
+		lineStart = eol + 1 - in.data;
+
+		turn = takeTurn(&maze, &session, input, &pf, &out);
+
+		//If user input is 'time', display system time using the time
+		//thread. The main thread is blocked until the time thread
+		//answers; the time thread then writes the time to the file
+		//currentTime.txt while the game carries on.
+		if(turn == TURN_TIME){
+			char curTime[41];
+			requestTime(curTime);
+			appendTime(curTime, &out);
+		}
+		else if(turn == TURN_SAVE){
+			saveTurn(&session, &out);
+		}
+		if(turn != TURN_DONE && turn != TURN_FAILED && 
+		   promptSession(&maze, &session, &out) == -1){
+			turn = TURN_FAILED;
+		}
+	}
+
+	//Print congratulations message and game stats (steps taken & path).
+	writeBuffer(&out, STDOUT_FILENO);
+
+	//Free memory used to hold user's path.
+	freeSession(&session);
+	freeBuffer(&out);
+	freeBuffer(&in);
+
+	if(pf.mark != NULL){
+		freePathFinder(&pf);
+	}
+	stopTimeService();
+	if(stats.enabled){
+		stats.play = now() - start;
+		printStats(statsFile);
+	}
+	unloadMaze(&maze);
+
+	return turn == TURN_FAILED ? EXIT_FAILURE : 0;
 }
 
 
@@ -413,4 +4871,8 @@ int main(int argc, char* argv[]){
  * "C Programming Language". Kernighan, Brian and Dennis Ritchie. 2nd Edition. Pearson Education, Inc. 1988.
  * https://www.tutorialspoint.com/c_standard_library/c_function_strftime.htm
  * https://linux.die.net/man/3/strftime
+ * https://man7.org/linux/man-pages/man2/mmap.2.html
+ * https://en.wikipedia.org/wiki/Bidirectional_search
+ * https://man7.org/linux/man-pages/man7/epoll.7.html
+ * https://man7.org/linux/man-pages/man7/unix.7.html
 ************************************************************************************************************/
@@ -11,6 +11,28 @@
 **				MID_ROOM. These type assignments are also random. The 7 
 **				rooms are choosen at random from a total possibility of 10
 **				rooms available for selection.
+**
+**				Passing --rooms N switches to "generator" mode, which builds
+**				a maze of N rooms in memory (see buildConnections()) with
+**				names derived from --seed and connection counts in the range
+**				--min-degree to --max-degree (3-6 by default). Adding
+**				--binary writes the maze as a single binary file (see
+**				fridkisb.maze.h) instead of one text file per room.
+**				--min-distance/--max-distance pick START_ROOM and END_ROOM
+**				rooms with a shortest path of that length (see
+**				chooseEnds()).
+**
+**				Once the maze is complete, the manifest fridkisb.latest
+**				is atomically updated to name its directory. --stdout
+**				instead writes the binary maze to standard output, to be
+**				piped straight into the game (fridkisb.adventure
+**				--maze-fd), with no directory at all.
+**
+**				Adding --count K generates a "pool" of K mazes on
+**				--threads T threads (one per CPU by default), written to
+**				fridkisb.pool.<pid>/maze.<index>. Each maze draws from
+**				its own PRNG stream derived from (seed, index), so any
+**				maze in a pool can be reproduced on its own.
 ****************************************************************************/
 
 #include <time.h>
@@ -19,7 +41,116 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <stdarg.h>
+#include "fridkisb.maze.h"
+
+//Room names are fixed at 8 characters (plus null-terminator),
+//matching the game's Room struct.
+#define NAME_LEN 8
+
+//Options set from the command line (see parseOptions()). A numRooms
+//of 0 means "classic" mode (7 of the 10 hard-coded rooms).
+typedef struct {
+	uint32_t numRooms;
+	int minDegree;
+	int maxDegree;
+	unsigned long seed;
+	int binary;					//Write MAZE_FILE_NAME instead of room files
+	int toStdout;				//Write the maze file to standard output instead
+	uint32_t count;				//Number of mazes to generate (0 = one, unpooled)
+	uint32_t minDistance;		//Steps from the START_ROOM to the END_ROOM
+	uint32_t maxDistance;		//(see chooseEnds(); 0 to UINT32_MAX = any)
+	int numThreads;
+	char* statsFile;			//Where --stats are printed (stderr if NULL)
+} Options;
+
+//Instrumentation enabled with --stats (see printStats()). Counters are
+//only updated when enabled is set, so with --stats off each costs a
+//single branch. Pool threads share them, so they are updated
+//atomically, and phase times are kept in nanoseconds (summed over
+//the threads).
+typedef struct {
+	int enabled;
+	uint64_t generateNs;		//Building mazes in memory
+	uint64_t writeNs;			//Writing them out
+	uint64_t mazes;
+	uint64_t rooms;
+	uint64_t connections;
+	uint64_t bridges;			//Connections added by bridgeComponents()
+	uint64_t files;
+	uint64_t bytesWritten;
+	uint64_t allocations;
+} Stats;
+
+static Stats stats;
+
+//In-memory maze used by generator mode. Connections are stored as
+//room IDs in a compressed adjacency array: the connections of room
+//i are targets[offsets[i]] through targets[offsets[i + 1] - 1].
+typedef struct {
+	uint32_t numRooms;
+	uint32_t startRoom;
+	uint32_t endRoom;
+	uint32_t* offsets;
+	uint32_t* targets;
+	char* names;				//numRooms names, NAME_LEN + 1 bytes each
+} Maze;
+
+//State of a xoshiro256** pseudo-random number generator. Generator
+//mode gives every maze its own Rng (see seedRng()) instead of sharing
+//rand(), so mazes can be built concurrently and reproduced one at a time.
+typedef struct {
+	uint64_t s[4];
+} Rng;
+
+//Union-find over room IDs, tracking which rooms are already
+//connected (directly or through other rooms) as connections are added.
+typedef struct {
+	uint32_t* parent;
+	uint8_t* rank;
+	uint32_t count;				//Number of components
+} Components;
+
+//Work shared by the threads generating a pool of mazes.
+typedef struct {
+	Options* opts;
+	int poolFd;					//Open pool directory
+	uint32_t nextMaze;			//Index of the next maze to generate (atomic)
+	int failed;					//Set when a maze could not be generated
+} Pool;
+
+//Function to add n to a counter, if stats are enabled.
+static inline void countStat(uint64_t* counter, uint64_t n){
+	if(stats.enabled){
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+	}
+}
+
+//Function to return the current time of the monotonic clock in
+//nanoseconds.
+uint64_t nowNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Function to print the stats, one "name value" line each, to out.
+//totalNs is the run time of the whole program.
+void printStats(FILE* out, uint64_t totalNs){
+	fprintf(out, "total_ms %.3f\n" "generate_ms %.3f\n" "write_ms %.3f\n", 
+		totalNs / 1e6, stats.generateNs / 1e6, stats.writeNs / 1e6);
+	fprintf(out, "mazes %lu\n" "rooms %lu\n" "connections %lu\n" "bridges %lu\n" 
+		"files %lu\n" "bytes_written %lu\n" "allocations %lu\n",
+		(unsigned long)stats.mazes, (unsigned long)stats.rooms, 
+		(unsigned long)stats.connections, (unsigned long)stats.bridges,
+		(unsigned long)stats.files, (unsigned long)stats.bytesWritten, 
+		(unsigned long)stats.allocations);
+}
 
 //Function to pick 7 of 10 hard-coded "rooms".
 int* pickRooms(){
@@ -30,7 +161,7 @@ int* pickRooms(){
 	static int roomPicker[7];
 	memset(roomPicker, -1, sizeof(roomPicker));
 	int i;
-	for(i = 0; i < 10; i++){
+	for(i = 0; i < 7; i++){
 		int random = rand() % 10;
 		int j;
 		for(j = 0; j < 7; j++){
@@ -51,30 +182,84 @@ int* pickRooms(){
 	return roomPicker;
 }
 
-//Function to create room files.
-FILE** createRooms(char** roomFileNames, char** roomNames, int* roomAssignment){
+//Contents of a room file, built in memory and written out whole by
+//writeRoomFile().
+typedef struct {
+	char* data;
+	size_t used;
+	size_t size;
+} RoomText;
+
+//Function to append formatted text to a room file's contents.
+void appendRoom(RoomText* t, const char* format, ...){
+	va_list args;
+	for(;;){
+		va_start(args, format);
+		int n = vsnprintf(t->data + t->used, t->size - t->used, format, args);
+		va_end(args);
+		if(n < 0){
+			perror("Error formatting room file");
+			exit(EXIT_FAILURE);
+		}
+		if(t->used + n < t->size){
+			t->used += n;
+			return;
+		}
+		t->size = (t->used + n + 1) * 2;
+		if((t->data = realloc(t->data, t->size)) == NULL){
+			perror("Error allocating memory for room file");
+			exit(EXIT_FAILURE);
+		}
+		countStat(&stats.allocations, 1);
+	}
+}
+
+//Function to create (or truncate) fileName in the directory dirFd
+//(AT_FDCWD for the current directory) and write t to it with a single
+//write() (more only if the kernel takes less). Writing relative to a
+//directory descriptor lets pool threads write their mazes without
+//changing the (process wide) working directory.
+void writeRoomFile(int dirFd, const char* fileName, const RoomText* t){
+	int fd;
+	if((fd = openat(dirFd, fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1){
+		perror("Unable to open room file.");
+		exit(EXIT_FAILURE);
+	}
+	size_t done = 0;
+	while(done < t->used){
+		ssize_t n = write(fd, t->data + done, t->used - done);
+		if(n == -1 && errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			perror("Error writing room file");
+			exit(EXIT_FAILURE);
+		}
+		done += n;
+	}
+	if(close(fd) != 0){
+		perror("Error writing room file");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.files, 1);
+	countStat(&stats.bytesWritten, t->used);
+}
+
+//Function to start the contents of the 7 room files, corresponding to
+//the randomly picked rooms (in the roomPicker array), with their
+//first line (ROOM NAME: <room name>).
+void createRooms(char** roomNames, int* roomAssignment, RoomText* rooms){
 	
-	//Create and open 7 files to correspond to randomly
-	//generated room numbers (in roomPicker array).
-	//Write the first line (ROOM NAME: <room name>) to each.
-	static FILE* roomFiles[7];
 	int i;
 	for(i = 0; i < 7; i++){
-		if((roomFiles[i] = (FILE*)(fopen(roomFileNames[roomAssignment[i]], "w+"))) == NULL){
-			perror("Unable to open room file.");
-			exit(EXIT_FAILURE);
-		}
-		fprintf(roomFiles[i], "ROOM NAME: %s\n", roomNames[roomAssignment[i]]);
-		
-		//Rewind each file stream for future use.
-		//Alternate: rewind(roomFiles[i]);
-		fseek(roomFiles[i], 0L, SEEK_SET);
+		appendRoom(&rooms[i], "ROOM NAME: %s\n", roomNames[roomAssignment[i]]);
 	}
-	return roomFiles;
 }
 
-//Function to randomly assign room connections.
-void loadConnections(char **roomNames, int* roomAssignment,	FILE** roomFiles){
+//Function to randomly assign room connections, also recording them
+//in linked (linked[a][b] is set if rooms a and b are connected).
+void loadConnections(char **roomNames, int* roomAssignment, RoomText* rooms, 
+		char linked[7][7]){
 
 	//This array will hold the number of connections established
 	//for each room.
@@ -83,17 +268,6 @@ void loadConnections(char **roomNames, int* roomAssignment,	FILE** roomFiles){
 	int i;
 	for(i = 0; i < 7; i++){
 		
-		//This string will hold the file contents of 
-		//each room file as its connections are processed/added,
-		//which is at maximum 157 characters (before adding room type).
-		char fileContents[158];
-		memset(fileContents, '\0', sizeof(fileContents));
-
-		//Rewind file position pointer of current room
-		rewind(roomFiles[i]);
-		//Read current room file contents into fileContent string.
-		fread(fileContents, 158, 1, roomFiles[i]);
-
 		//Generate random number of room connections
 		//in range 3 - 6 (inclusive).
 		//(cc is short for 'connection count'.)
@@ -106,9 +280,10 @@ void loadConnections(char **roomNames, int* roomAssignment,	FILE** roomFiles){
 			//Generate random room.
 			int rr = rand() % 7;
 			//Make sure randomly selected room isn't already a connection for
-			//the current room, and if so move through rooms until an unused
-			//(i.e. not yet connected) room is found.
-			while(strstr(fileContents, roomNames[roomAssignment[rr]]) != NULL){
+			//the current room (or the room itself, named on its first line),
+			//and if so move through rooms until an unused (i.e. not yet
+			//connected) room is found.
+			while(strstr(rooms[i].data, roomNames[roomAssignment[rr]]) != NULL){
 				if(rr == 6){
 					rr = 0;
 				}
@@ -116,46 +291,1119 @@ void loadConnections(char **roomNames, int* roomAssignment,	FILE** roomFiles){
 					rr++;
 				}
 			}
-			//Place file pointer at end of file.
-			fseek(roomFiles[i], 0L, SEEK_END);
 			
 			//Add (forward) room connection, from current room to randomly selected
 			//room, and increment number of connections for current room.
-			fprintf(roomFiles[i], "CONNECTION %d: %s\n", ++connectionCount[i], 
+			appendRoom(&rooms[i], "CONNECTION %d: %s\n", ++connectionCount[i], 
 				roomNames[roomAssignment[rr]]);
-			
-			//Update the fileContent string to include the new connection.
-			snprintf(fileContents + strlen(fileContents), 158 - strlen(fileContents), 
-				"CONNECTION %d: %s\n", connectionCount[i], roomNames[roomAssignment[rr]]);
-			
-			//Place file pointer at end of file for the room just added.
-			fseek(roomFiles[rr], 0L, SEEK_END);
 		
 			//Add (backward) room connection, from randomly selected room to
 			//current room, and increment number of connections for randomly 
 			//selected room.
-			fprintf(roomFiles[rr], "CONNECTION %d: %s\n",
+			appendRoom(&rooms[rr], "CONNECTION %d: %s\n",
 				++connectionCount[rr], roomNames[roomAssignment[i]]);
+			linked[i][rr] = linked[rr][i] = 1;
+			countStat(&stats.connections, 1);
+		}
+	}
+}
+
+//Function to randomly pick the START_ROOM (*start) and END_ROOM (*end)
+//of the 7 rooms from the pairs whose shortest path (through linked)
+//takes minDistance to maxDistance steps. Returns 0 if there are none.
+int chooseClassicEnds(char linked[7][7], uint32_t minDistance, uint32_t maxDistance, 
+		int* start, int* end){
+	
+	//Find the distance between every pair of rooms (Floyd-Warshall).
+	uint32_t dist[7][7];
+	int i, j, k;
+	for(i = 0; i < 7; i++){
+		for(j = 0; j < 7; j++){
+			dist[i][j] = i == j ? 0 : (linked[i][j] ? 1 : 7);
+		}
+	}
+	for(k = 0; k < 7; k++){
+		for(i = 0; i < 7; i++){
+			for(j = 0; j < 7; j++){
+				if(dist[i][k] + dist[k][j] < dist[i][j]){
+					dist[i][j] = dist[i][k] + dist[k][j];
+				}
+			}
+		}
+	}
+
+	int pairs[42][2], numPairs = 0;
+	for(i = 0; i < 7; i++){
+		for(j = 0; j < 7; j++){
+			if(i != j && dist[i][j] < 7 && dist[i][j] >= minDistance && 
+			   dist[i][j] <= maxDistance){
+				pairs[numPairs][0] = i;
+				pairs[numPairs++][1] = j;
+			}
+		}
+	}
+	if(numPairs == 0){
+		return 0;
+	}
+	int pick = rand() % numPairs;
+	*start = pairs[pick][0];
+	*end = pairs[pick][1];
+	return 1;
+}
+
+//Function to assign room types: START_ROOM to rooms[start], END_ROOM to
+//rooms[end] and MID_ROOM to the rest.
+void assignRT(RoomText* rooms, int start, int end){
+	
+	int i;
+	for(i = 0; i < 7; i++){
+		appendRoom(&rooms[i], "ROOM TYPE: %s", i == start ? "START_ROOM" : 
+			(i == end ? "END_ROOM" : "MID_ROOM"));
+	}
+}
+
+//Function to print usage information and exit.
+void usage(char* prog){
+	fprintf(stderr, "Usage: %s [--rooms N] [--min-degree D] [--max-degree D] [--seed S] [--binary|--stdout]\n"
+		"          [--min-distance D] [--max-distance D] [--count K] [--threads T]\n"
+		"          [--stats] [--stats-file <file>]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+//Function to convert an option argument to an unsigned number,
+//exiting with a usage message if it is missing or malformed.
+unsigned long parseNumber(int argc, char* argv[], int i){
+	if(i >= argc){
+		usage(argv[0]);
+	}
+	char* end;
+	errno = 0;
+	unsigned long n = strtoul(argv[i], &end, 10);
+	if(errno != 0 || *end != '\0' || argv[i][0] == '-' || end == argv[i]){
+		fprintf(stderr, "Invalid number for %s: %s\n", argv[i - 1], argv[i]);
+		usage(argv[0]);
+	}
+	return n;
+}
+
+//Function to convert a --min-degree/--max-degree argument, exiting
+//with a message if it does not fit the range of a degree.
+int parseDegree(int argc, char* argv[], int i){
+	unsigned long n = parseNumber(argc, argv, i);
+	if(n < 1 || n > INT_MAX){
+		fprintf(stderr, "%s must be between 1 and %d\n", argv[i - 1], INT_MAX);
+		exit(EXIT_FAILURE);
+	}
+	return (int)n;
+}
+
+//Function to describe the --min-distance/--max-distance range of opts
+//(in a static buffer), for error messages.
+const char* distanceRange(Options* opts){
+	static char range[48];
+	uint32_t min = opts->minDistance > 0 ? opts->minDistance : 1;
+	if(opts->maxDistance == UINT32_MAX){
+		snprintf(range, sizeof(range), "at least %u", min);
+	}
+	else if(min == opts->maxDistance){
+		snprintf(range, sizeof(range), "%u", min);
+	}
+	else{
+		snprintf(range, sizeof(range), "%u to %u", min, opts->maxDistance);
+	}
+	return range;
+}
+
+//Function to parse command line options into opts.
+void parseOptions(int argc, char* argv[], Options* opts){
+	
+	opts->numRooms = 0;
+	opts->minDegree = 3;
+	opts->maxDegree = 6;
+	//Mix in the process ID so runs started in the same second differ.
+	opts->seed = (unsigned long)time(NULL) ^ ((unsigned long)getpid() << 32);
+	opts->binary = 0;
+	opts->toStdout = 0;
+	opts->count = 0;
+	opts->minDistance = 0;
+	opts->maxDistance = UINT32_MAX;
+	opts->numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	opts->statsFile = NULL;
+
+	int i;
+	for(i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--rooms") == 0){
+			unsigned long n = parseNumber(argc, argv, ++i);
+			if(n < 2 || n > UINT32_MAX - 1){
+				fprintf(stderr, "--rooms must be between 2 and %lu\n", 
+					(unsigned long)UINT32_MAX - 1);
+				exit(EXIT_FAILURE);
+			}
+			opts->numRooms = (uint32_t)n;
+		}
+		else if(strcmp(argv[i], "--min-degree") == 0){
+			opts->minDegree = parseDegree(argc, argv, ++i);
+		}
+		else if(strcmp(argv[i], "--max-degree") == 0){
+			opts->maxDegree = parseDegree(argc, argv, ++i);
+		}
+		else if(strcmp(argv[i], "--seed") == 0){
+			opts->seed = parseNumber(argc, argv, ++i);
+		}
+		else if(strcmp(argv[i], "--binary") == 0){
+			opts->binary = 1;
+		}
+		else if(strcmp(argv[i], "--stdout") == 0){
+			opts->binary = opts->toStdout = 1;
+		}
+		else if(strcmp(argv[i], "--count") == 0){
+			unsigned long n = parseNumber(argc, argv, ++i);
+			if(n < 1 || n > UINT32_MAX){
+				fprintf(stderr, "--count must be at least 1\n");
+				exit(EXIT_FAILURE);
+			}
+			opts->count = (uint32_t)n;
+		}
+		else if(strcmp(argv[i], "--min-distance") == 0){
+			unsigned long n = parseNumber(argc, argv, ++i);
+			if(n < 1 || n > UINT32_MAX){
+				fprintf(stderr, "--min-distance must be at least 1\n");
+				exit(EXIT_FAILURE);
+			}
+			opts->minDistance = (uint32_t)n;
+		}
+		else if(strcmp(argv[i], "--max-distance") == 0){
+			unsigned long n = parseNumber(argc, argv, ++i);
+			if(n < 1 || n > UINT32_MAX){
+				fprintf(stderr, "--max-distance must be at least 1\n");
+				exit(EXIT_FAILURE);
+			}
+			opts->maxDistance = (uint32_t)n;
+		}
+		else if(strcmp(argv[i], "--threads") == 0){
+			unsigned long n = parseNumber(argc, argv, ++i);
+			if(n < 1 || n > 1024){
+				fprintf(stderr, "--threads must be between 1 and 1024\n");
+				exit(EXIT_FAILURE);
+			}
+			opts->numThreads = (int)n;
+		}
+		else if(strcmp(argv[i], "--stats") == 0){
+			stats.enabled = 1;
+		}
+		else if(strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc){
+			stats.enabled = 1;
+			opts->statsFile = argv[++i];
+		}
+		else{
+			usage(argv[0]);
+		}
+	}
+
+	if(opts->minDegree < 1 || opts->maxDegree < opts->minDegree){
+		fprintf(stderr, "Degrees must satisfy 1 <= --min-degree <= --max-degree\n");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->numRooms > 0 && (uint32_t)opts->maxDegree > opts->numRooms - 1){
+		fprintf(stderr, "--max-degree must be less than --rooms\n");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->numRooms > 2 && opts->maxDegree < 2){
+		fprintf(stderr, "--max-degree must be at least 2 for every room to be reachable\n");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->binary && opts->numRooms == 0){
+		fprintf(stderr, "%s requires --rooms\n", opts->toStdout ? "--stdout" : "--binary");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->minDistance > opts->maxDistance){
+		fprintf(stderr, "--min-distance must not be more than --max-distance\n");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->toStdout && opts->count > 0){
+		fprintf(stderr, "--stdout writes a single maze, so cannot be used with --count\n");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->count > 0 && opts->numRooms == 0){
+		fprintf(stderr, "--count requires --rooms\n");
+		exit(EXIT_FAILURE);
+	}
+	if(opts->numThreads < 1){
+		opts->numThreads = 1;
+	}
+}
+
+//Function to scramble a 64 bit value (splitmix64 finalizer). Used to
+//seed the Rng of each maze.
+uint64_t mix64(uint64_t x){
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+//Function to seed r with the stream for maze number index of seed.
+//The state is filled from a splitmix64 sequence, as recommended by
+//the xoshiro authors, so nearby seeds and indexes give unrelated streams.
+void seedRng(Rng* r, uint64_t seed, uint64_t index){
+	uint64_t x = mix64(mix64(seed) + index);
+	int i;
+	for(i = 0; i < 4; i++){
+		r->s[i] = mix64(x);
+		x += 0x9E3779B97F4A7C15ULL;
+	}
+}
+
+//Function to return the next 64 bit value of r (xoshiro256**).
+uint64_t nextRng(Rng* r){
+	uint64_t* s = r->s;
+	uint64_t x = s[1] * 5;
+	uint64_t result = ((x << 7) | (x >> 57)) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	return result;
+}
+
+//Function to return a random number in the range 0 - (n - 1), by
+//scaling the top 32 bits of the next value instead of using modulo.
+uint32_t randomBelow(Rng* r, uint32_t n){
+	return (uint32_t)(((nextRng(r) >> 32) * n) >> 32);
+}
+
+//Function to generate a name for every room in the maze.
+//Room i is named by writing (a * i + b) mod 26^8 in base 26 using the
+//letters A-Z. With a coprime to 26 this map is a bijection, so every
+//room gets a distinct name without any duplicate checking. The value
+//is stepped by a each room rather than multiplied out, since a * i
+//no longer fits in 64 bits once i passes about 2^26.
+void nameRooms(Maze* m, Rng* rng){
+	
+	const uint64_t space = 208827064576ULL;		//26^8
+	uint64_t a = nextRng(rng) % space;
+	uint64_t b = nextRng(rng) % space;
+	
+	//Make a coprime to 26 (i.e. odd and not a multiple of 13).
+	a |= 1;
+	while(a % 13 == 0){
+		a += 2;
+	}
+	a %= space;
+
+	if((m->names = malloc((size_t)m->numRooms * (NAME_LEN + 1))) == NULL){
+		perror("Error allocating memory for room names");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 1);
+
+	uint64_t step = b;
+	uint32_t i;
+	for(i = 0; i < m->numRooms; i++){
+		uint64_t v = step;
+		step += a;
+		if(step >= space){
+			step -= space;
+		}
+		char* name = m->names + (size_t)i * (NAME_LEN + 1);
+		int d;
+		for(d = NAME_LEN - 1; d >= 0; d--){
+			name[d] = 'A' + (char)(v % 26);
+			v /= 26;
+		}
+		name[NAME_LEN] = '\0';
+	}
+}
+
+//Function to start with every one of n rooms in its own component.
+void initComponents(Components* c, uint32_t n){
+	c->parent = malloc((size_t)n * sizeof(uint32_t));
+	c->rank = calloc(n, sizeof(uint8_t));
+	if(c->parent == NULL || c->rank == NULL){
+		perror("Error allocating memory for room components");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 2);
+	uint32_t i;
+	for(i = 0; i < n; i++){
+		c->parent[i] = i;
+	}
+	c->count = n;
+}
+
+//Function to return the representative room of the component holding
+//room x, pointing every room on the way directly at it (path compression).
+uint32_t findComponent(Components* c, uint32_t x){
+	uint32_t root = x;
+	while(c->parent[root] != root){
+		root = c->parent[root];
+	}
+	while(c->parent[x] != root){
+		uint32_t next = c->parent[x];
+		c->parent[x] = root;
+		x = next;
+	}
+	return root;
+}
+
+//Function to merge the components holding rooms a and b, hanging the
+//shallower tree under the deeper one (union by rank).
+void joinComponents(Components* c, uint32_t a, uint32_t b){
+	a = findComponent(c, a);
+	b = findComponent(c, b);
+	if(a == b){
+		return;
+	}
+	if(c->rank[a] < c->rank[b]){
+		uint32_t t = a;
+		a = b;
+		b = t;
+	}
+	c->parent[b] = a;
+	if(c->rank[a] == c->rank[b]){
+		c->rank[a]++;
+	}
+	c->count--;
+}
+
+//Function to free a Components.
+void freeComponents(Components* c){
+	free(c->parent);
+	free(c->rank);
+	c->parent = NULL;
+	c->rank = NULL;
+}
+
+//Function to change the connection of room from old to new in the
+//scratch adjacency (see buildConnections()).
+void replaceLink(uint32_t* adj, size_t stride, uint32_t* degree, uint32_t room, 
+		uint32_t old, uint32_t new){
+	uint32_t j;
+	for(j = 0; j < degree[room]; j++){
+		if(adj[room * stride + j] == old){
+			adj[room * stride + j] = new;
+			return;
+		}
+	}
+}
+
+//Function to find a connection (*u, *v) which lies on a cycle, so it
+//can be removed without disconnecting anything. Every room reached from
+//start must have at least 2 connections: the walk never turns straight
+//back, so it must eventually reach a room it has already seen, and the
+//connection leading there closes a cycle.
+void findCycleLink(uint32_t* adj, size_t stride, uint32_t* seen, uint32_t stamp, 
+		uint32_t start, uint32_t* u, uint32_t* v){
+	uint32_t prev = start, cur = start;
+	for(;;){
+		seen[cur] = stamp;
+		uint32_t next = adj[cur * stride] != prev ? 
+			adj[cur * stride] : adj[cur * stride + 1];
+		if(seen[next] == stamp){
+			*u = cur;
+			*v = next;
+			return;
+		}
+		prev = cur;
+		cur = next;
+	}
+}
+
+//Function to add bridging connections until all rooms are in one
+//component, so the END_ROOM is always reachable. Components are merged
+//one at a time into the component of room 0 (M), joining a room with
+//spare capacity on each side. If one side is full, every room there
+//has maxDegree (>= 2) connections, so it has a connection (u, v) on a
+//cycle: that is removed and u and v are connected to the other side
+//instead (swapping out one of its connections if needed), which keeps
+//every room within maxDegree.
+void bridgeComponents(uint32_t* adj, size_t stride, uint32_t* degree, uint32_t n, 
+		int maxDegree, Components* c){
+	
+	if(c->count == 1){
+		return;
+	}
+
+	//Group the rooms by component (counting sort on the representative).
+	uint32_t numComps = c->count;
+	uint32_t* label = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* members = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* start = calloc((size_t)numComps + 1, sizeof(uint32_t));
+	uint32_t* merged = malloc((size_t)numComps * sizeof(uint32_t));
+	uint32_t* seen = calloc(n, sizeof(uint32_t));
+	if(label == NULL || members == NULL || start == NULL || merged == NULL || seen == NULL){
+		perror("Error allocating memory for room components");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 5);
+	countStat(&stats.bridges, numComps - 1);
+	uint32_t i, k = 0;
+	for(i = 0; i < n; i++){
+		if(c->parent[i] == i){
+			label[i] = k++;
+		}
+	}
+	for(i = 0; i < n; i++){
+		label[i] = label[findComponent(c, i)];
+		start[label[i] + 1]++;
+	}
+	for(k = 0; k < numComps; k++){
+		start[k + 1] += start[k];
+	}
+	for(i = 0; i < n; i++){
+		members[start[label[i]]++] = i;
+	}
+	for(k = numComps; k > 0; k--){
+		start[k] = start[k - 1];
+	}
+	start[0] = 0;
+
+	//merged lists the components making up M. Rooms only ever gain
+	//connections, so the search for a spare room in M never goes back.
+	uint32_t numMerged = 1, mPos = 0, mOff = 0, stamp = 0;
+	merged[0] = label[0];
+	for(k = 0; k < numComps; k++){
+		if(k == label[0]){
+			continue;
+		}
+
+		//Find the room of this component with the most spare capacity.
+		uint32_t cRoom = n;
+		for(i = start[k]; i < start[k + 1]; i++){
+			if(degree[members[i]] < (uint32_t)maxDegree && 
+			   (cRoom == n || degree[members[i]] < degree[cRoom])){
+				cRoom = members[i];
+			}
+		}
+		//Find the next room of M with spare capacity.
+		uint32_t mRoom = n;
+		while(mPos < numMerged && mRoom == n){
+			uint32_t m = merged[mPos];
+			if(start[m] + mOff == start[m + 1]){
+				mPos++;
+				mOff = 0;
+			}
+			else if(degree[members[start[m] + mOff]] < (uint32_t)maxDegree){
+				mRoom = members[start[m] + mOff];
+			}
+			else{
+				mOff++;
+			}
+		}
+
+		if(cRoom != n && mRoom != n){
+			adj[cRoom * stride + degree[cRoom]++] = mRoom;
+			adj[mRoom * stride + degree[mRoom]++] = cRoom;
+		}
+		else{
+			//Break a cycle on the full side, and connect both of its
+			//ends to room o on the other side.
+			uint32_t u, v;
+			uint32_t o = cRoom == n ? (mRoom == n ? 0 : mRoom) : cRoom;
+			findCycleLink(adj, stride, seen, ++stamp, 
+				cRoom == n ? members[start[k]] : 0, &u, &v);
+			if((uint32_t)maxDegree - degree[o] >= 2){
+				replaceLink(adj, stride, degree, u, v, o);
+				replaceLink(adj, stride, degree, v, u, o);
+				adj[o * stride + degree[o]++] = u;
+				adj[o * stride + degree[o]++] = v;
+			}
+			else{
+				//o has a connection y to trade: u-v and o-y become
+				//u-o and v-y.
+				uint32_t y = adj[o * stride];
+				replaceLink(adj, stride, degree, u, v, o);
+				replaceLink(adj, stride, degree, o, y, u);
+				replaceLink(adj, stride, degree, v, u, y);
+				replaceLink(adj, stride, degree, y, o, v);
+			}
+		}
+		joinComponents(c, members[start[k]], 0);
+		merged[numMerged++] = k;
+	}
+
+	free(label);
+	free(members);
+	free(start);
+	free(merged);
+	free(seen);
+}
+
+//Function to randomly assign room connections in generator mode.
+//Works like loadConnections(), but on room IDs held in memory:
+//each room is given a random target connection count in the range
+//minDegree - maxDegree, and connections are added to randomly chosen
+//rooms that still have fewer than maxDegree connections (the "open"
+//rooms). Duplicate checks only scan the (at most maxDegree) existing
+//connections of a room, so the whole build runs in linear time.
+//Components are tracked as connections are added, and any left
+//unconnected at the end are bridged (see bridgeComponents()).
+void buildConnections(Maze* m, int minDegree, int maxDegree, Rng* rng){
+	
+	uint32_t n = m->numRooms;
+	size_t stride = (size_t)maxDegree;
+
+	//Scratch adjacency with a fixed maxDegree slots per room,
+	//compacted into offsets/targets once all connections are made.
+	uint32_t* adj = malloc((size_t)n * stride * sizeof(uint32_t));
+	uint32_t* degree = calloc(n, sizeof(uint32_t));
+	//open holds the IDs of all rooms with spare capacity, and
+	//openPos the index of each room within open (for O(1) removal).
+	uint32_t* open = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* openPos = malloc((size_t)n * sizeof(uint32_t));
+	if(adj == NULL || degree == NULL || open == NULL || openPos == NULL){
+		perror("Error allocating memory for room connections");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 6);		//Including offsets and targets below
+	uint32_t numOpen = n;
+	uint32_t i;
+	for(i = 0; i < n; i++){
+		open[i] = openPos[i] = i;
+	}
+	Components comps;
+	initComponents(&comps, n);
+
+	for(i = 0; i < n; i++){
+		
+		//(cc is short for 'connection count'.)
+		uint32_t cc = (uint32_t)(minDegree + randomBelow(rng, maxDegree - minDegree + 1));
+		
+		while(degree[i] < cc){
+			//Pick a random open room, retrying a few times if it is
+			//the current room or already connected to it, then fall
+			//back to scanning the open rooms in order.
+			uint32_t rr = n;
+			int tries;
+			uint32_t k = 0;
+			for(tries = 0; tries < 16 + (int)numOpen; tries++){
+				uint32_t candidate = tries < 16 ? 
+					open[randomBelow(rng, numOpen)] : open[k++];
+				if(candidate == i){
+					continue;
+				}
+				uint32_t j;
+				for(j = 0; j < degree[i]; j++){
+					if(adj[i * stride + j] == candidate){
+						break;
+					}
+				}
+				if(j == degree[i]){
+					rr = candidate;
+					break;
+				}
+			}
+			//No room is left to connect to.
+			if(rr == n){
+				break;
+			}
+			
+			//Add the (forward) and (backward) connection, and close
+			//either room once it reaches maxDegree.
+			adj[i * stride + degree[i]++] = rr;
+			adj[rr * stride + degree[rr]++] = i;
+			joinComponents(&comps, i, rr);
+			uint32_t ends[2] = {i, rr};
+			int e;
+			for(e = 0; e < 2; e++){
+				if(degree[ends[e]] == (uint32_t)maxDegree){
+					uint32_t last = open[--numOpen];
+					open[openPos[ends[e]]] = last;
+					openPos[last] = openPos[ends[e]];
+				}
+			}
+		}
+	}
+
+	bridgeComponents(adj, stride, degree, n, maxDegree, &comps);
+	freeComponents(&comps);
+
+	//Compact the scratch adjacency into offsets/targets.
+	if((m->offsets = malloc(((size_t)n + 1) * sizeof(uint32_t))) == NULL){
+		perror("Error allocating memory for room connections");
+		exit(EXIT_FAILURE);
+	}
+	m->offsets[0] = 0;
+	for(i = 0; i < n; i++){
+		m->offsets[i + 1] = m->offsets[i] + degree[i];
+	}
+	if((m->targets = malloc(((size_t)m->offsets[n] + 1) * sizeof(uint32_t))) == NULL){
+		perror("Error allocating memory for room connections");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0; i < n; i++){
+		memcpy(m->targets + m->offsets[i], adj + i * stride, degree[i] * sizeof(uint32_t));
+	}
+
+	free(adj);
+	free(degree);
+	free(open);
+	free(openPos);
+}
+
+//START_ROOM candidates tried by chooseEnds() before giving up.
+#define MAX_START_TRIES 16
+
+//Function to pick the START_ROOM and END_ROOM of m so that the
+//shortest path between them takes minDistance to maxDistance steps.
+//Each candidate START_ROOM is searched breadth first, no further than
+//maxDistance steps (so narrow targets stay cheap in big mazes), and
+//the END_ROOM is drawn from the rooms the search reached at least
+//minDistance steps away. Candidates are drawn from rng, except that
+//after a random candidate falls short the search is repeated from the
+//farthest room it reached, which lies near the edge of the maze and
+//so has the longest paths to offer. The search buffers are allocated
+//once for every candidate, and after each search only the entries it
+//touched are cleared. Returns 0 if no candidate has such a room.
+int chooseEnds(Maze* m, uint32_t minDistance, uint32_t maxDistance, Rng* rng){
+	
+	uint32_t n = m->numRooms, i, j;
+	//dist[i] is the steps from the candidate to room i (UINT32_MAX if
+	//not reached), and queue holds the rooms reached, nearest first.
+	uint32_t* dist = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* queue = malloc((size_t)n * sizeof(uint32_t));
+	if(dist == NULL || queue == NULL){
+		perror("Error allocating memory for room search");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 2);
+	memset(dist, 0xFF, (size_t)n * sizeof(uint32_t));
+
+	int found = 0, tries, sweep = 0;
+	uint32_t start = 0;
+	for(tries = 0; tries < MAX_START_TRIES && !found; tries++){
+		//sweep is set when start is the farthest room of the last search.
+		if(!sweep){
+			start = randomBelow(rng, n);
+		}
+		uint32_t head = 0, tail = 0, far = n;	//far: first queued room far enough
+		dist[start] = 0;
+		queue[tail++] = start;
+		while(head < tail){
+			uint32_t room = queue[head++];
+			if(dist[room] == maxDistance){
+				break;
+			}
+			for(j = m->offsets[room]; j < m->offsets[room + 1]; j++){
+				uint32_t next = m->targets[j];
+				if(dist[next] == UINT32_MAX){
+					dist[next] = dist[room] + 1;
+					if(dist[next] >= minDistance && far == n){
+						far = tail;
+					}
+					queue[tail++] = next;
+				}
+			}
+		}
+		if(far < tail){
+			m->startRoom = start;
+			m->endRoom = queue[far + randomBelow(rng, tail - far)];
+			found = 1;
+		}
+		sweep = !sweep;
+		start = queue[tail - 1];
+		for(i = 0; i < tail; i++){
+			dist[queue[i]] = UINT32_MAX;
+		}
+	}
+
+	free(dist);
+	free(queue);
+	return found;
+}
+
+//Function to renumber the rooms of m in breadth-first order from the
+//START_ROOM. Connections are made between random rooms, so a room's
+//neighbours are scattered over the whole maze; after renumbering, the
+//rooms reached from each room get consecutive IDs, so their entries in
+//offsets/targets (and names) sit next to each other, and a search or
+//walk through the maze reads far fewer distinct cache lines and pages.
+//Each room keeps its name and connections, only the IDs change.
+void orderRooms(Maze* m){
+	
+	uint32_t n = m->numRooms, i, j;
+	uint32_t numTargets = m->offsets[n];
+	//order[k] is the old ID of new room k, and rank[i] the new ID of
+	//old room i (n while not yet reached).
+	uint32_t* order = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* rank = malloc((size_t)n * sizeof(uint32_t));
+	uint32_t* offsets = malloc(((size_t)n + 1) * sizeof(uint32_t));
+	uint32_t* targets = malloc(((size_t)numTargets + 1) * sizeof(uint32_t));
+	char* names = malloc((size_t)n * (NAME_LEN + 1));
+	if(order == NULL || rank == NULL || offsets == NULL || targets == NULL || names == NULL){
+		perror("Error allocating memory for room order");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 5);
+	for(i = 0; i < n; i++){
+		rank[i] = n;
+	}
+
+	//The queue of the search is order itself. Every room is reachable
+	//(see bridgeComponents()), but any that were not would simply be
+	//numbered last.
+	uint32_t numOrdered = 0, head = 0;
+	order[numOrdered] = m->startRoom;
+	rank[m->startRoom] = numOrdered++;
+	for(i = 0; numOrdered < n || head < numOrdered; ){
+		if(head == numOrdered){
+			while(rank[i] != n){
+				i++;
+			}
+			order[numOrdered] = i;
+			rank[i] = numOrdered++;
+		}
+		uint32_t room = order[head++];
+		for(j = m->offsets[room]; j < m->offsets[room + 1]; j++){
+			if(rank[m->targets[j]] == n){
+				order[numOrdered] = m->targets[j];
+				rank[m->targets[j]] = numOrdered++;
+			}
+		}
+	}
+
+	offsets[0] = 0;
+	for(i = 0; i < n; i++){
+		uint32_t room = order[i];
+		offsets[i + 1] = offsets[i] + (m->offsets[room + 1] - m->offsets[room]);
+		for(j = m->offsets[room]; j < m->offsets[room + 1]; j++){
+			targets[offsets[i] + j - m->offsets[room]] = rank[m->targets[j]];
+		}
+		memcpy(names + (size_t)i * (NAME_LEN + 1), 
+			m->names + (size_t)room * (NAME_LEN + 1), NAME_LEN + 1);
+	}
+	m->startRoom = rank[m->startRoom];
+	m->endRoom = rank[m->endRoom];
+
+	free(m->offsets);
+	free(m->targets);
+	free(m->names);
+	m->offsets = offsets;
+	m->targets = targets;
+	m->names = names;
+	free(order);
+	free(rank);
+}
+
+//Function to create (or truncate) fileName in the directory dirFd
+//and open it for writing (see writeRoomFile()).
+FILE* createFile(int dirFd, const char* fileName){
+	int fd;
+	FILE* fp;
+	if((fd = openat(dirFd, fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1){
+		return NULL;
+	}
+	if((fp = fdopen(fd, "w")) == NULL){
+		close(fd);
+	}
+	return fp;
+}
+
+//Function to write the generated maze to room files in dirFd, in the
+//same format as createRooms()/loadConnections()/assignRT(). Each
+//room's contents are built in one reused buffer and written with one
+//write(), so only one file is open at a time.
+void writeRooms(Maze* m, int dirFd){
+	
+	char fileName[NAME_LEN + 6];
+	RoomText text = {NULL, 0, 0};
+	uint32_t i;
+	for(i = 0; i < m->numRooms; i++){
+		char* name = m->names + (size_t)i * (NAME_LEN + 1);
+		snprintf(fileName, sizeof(fileName), "%s_room", name);
+		text.used = 0;
+		appendRoom(&text, "ROOM NAME: %s\n", name);
+		uint32_t j;
+		for(j = m->offsets[i]; j < m->offsets[i + 1]; j++){
+			appendRoom(&text, "CONNECTION %u: %s\n", j - m->offsets[i] + 1, 
+				m->names + (size_t)m->targets[j] * (NAME_LEN + 1));
 		}
+		appendRoom(&text, "ROOM TYPE: %s", i == m->startRoom ? "START_ROOM" : 
+			(i == m->endRoom ? "END_ROOM" : "MID_ROOM"));
+		writeRoomFile(dirFd, fileName, &text);
+	}
+	free(text.data);
+}
+
+//Function to write one section of the binary maze file, followed by
+//zero padding up to the next 8 byte boundary.
+void writeSection(FILE* fp, const void* data, size_t size){
+	static const char padding[8];
+	if(fwrite(data, 1, size, fp) != size || 
+	   fwrite(padding, 1, MAZE_ALIGN(size) - size, fp) != MAZE_ALIGN(size) - size){
+		perror("Error writing " MAZE_FILE_NAME);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Function to write the generated maze as a single binary file in
+//dirFd (see fridkisb.maze.h), which the game maps into memory and uses
+//without any parsing. A dirFd of -1 writes it to standard output
+//instead, for the game to read from a pipe (see --maze-fd).
+void writeMazeFile(Maze* m, int dirFd){
+	
+	uint64_t n = m->numRooms;
+	size_t nameStride = NAME_LEN + 1;
+
+	MazeHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAZE_MAGIC, sizeof(header.magic));
+	header.version = MAZE_VERSION;
+	header.numRooms = m->numRooms;
+	header.numTargets = m->offsets[n];
+	header.startRoom = m->startRoom;
+	header.endRoom = m->endRoom;
+	header.stringsSize = (uint32_t)(n * nameStride);
+	header.nameIndexOffset = MAZE_ALIGN(sizeof(header));
+	header.adjIndexOffset = header.nameIndexOffset + MAZE_ALIGN(n * sizeof(uint32_t));
+	header.adjOffset = header.adjIndexOffset + MAZE_ALIGN((n + 1) * sizeof(uint32_t));
+	header.stringsOffset = header.adjOffset + 
+		MAZE_ALIGN((uint64_t)header.numTargets * sizeof(uint32_t));
+	header.fileSize = header.stringsOffset + MAZE_ALIGN(header.stringsSize);
+	
+	//Names are stored at a fixed stride, so the name index is
+	//just multiples of that stride.
+	uint32_t* nameIndex;
+	if((nameIndex = malloc(n * sizeof(uint32_t))) == NULL){
+		perror("Error allocating memory for name index");
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.allocations, 1);
+	uint64_t i;
+	for(i = 0; i < n; i++){
+		nameIndex[i] = (uint32_t)(i * nameStride);
+	}
+
+	FILE* fp = stdout;
+	if(dirFd != -1 && (fp = createFile(dirFd, MAZE_FILE_NAME)) == NULL){
+		perror("Unable to open " MAZE_FILE_NAME);
+		exit(EXIT_FAILURE);
 	}
+	writeSection(fp, &header, sizeof(header));
+	writeSection(fp, nameIndex, n * sizeof(uint32_t));
+	writeSection(fp, m->offsets, (n + 1) * sizeof(uint32_t));
+	writeSection(fp, m->targets, (size_t)header.numTargets * sizeof(uint32_t));
+	writeSection(fp, m->names, header.stringsSize);
+	if((fp == stdout ? fflush(fp) : fclose(fp)) != 0){
+		perror("Error writing " MAZE_FILE_NAME);
+		exit(EXIT_FAILURE);
+	}
+	countStat(&stats.files, 1);
+	countStat(&stats.bytesWritten, header.fileSize);
+
+	free(nameIndex);
+}
+
+//Function to record roomsDir as the newest maze in the manifest
+//LATEST_FILE_NAME (in the parent of the current directory), so the
+//game can find it without scanning for directories. The manifest is
+//written to a temporary file and renamed over the old one, so readers
+//always see a complete manifest for a complete maze.
+void writeManifest(char* roomsDir, Options* opts, uint32_t numRooms){
+	
+	char tmpName[64];
+	snprintf(tmpName, sizeof(tmpName), "../%s.%d", LATEST_FILE_NAME, (int)getpid());
+	FILE* fp;
+	if((fp = fopen(tmpName, "w")) == NULL){
+		perror("Unable to open " LATEST_FILE_NAME);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(fp, "%s\nrooms %u\nseed %lu\nformat %s\ncreated %ld\n", roomsDir, numRooms,
+		opts->seed, opts->binary ? "binary" : "text", (long)time(NULL));
+	if(fclose(fp) != 0 || rename(tmpName, "../" LATEST_FILE_NAME) != 0){
+		perror("Error writing " LATEST_FILE_NAME);
+		unlink(tmpName);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Function to free a generated maze.
+void freeMaze(Maze* m){
+	free(m->offsets);
+	free(m->targets);
+	free(m->names);
+	m->offsets = m->targets = NULL;
+	m->names = NULL;
 }
 
-//Function to assign room types.
-void assignRT(FILE** roomFiles){
+//Mazes built by generateMaze() before giving up on finding a
+//START_ROOM and END_ROOM the requested distance apart.
+#define MAX_MAZE_TRIES 8
+
+//Function to generate maze number index for opts and write it to
+//dirFd (standard output if -1, see writeMazeFile()). Everything
+//random about the maze comes from its own Rng, so the result depends
+//only on (seed, index). If the maze has no START_ROOM and END_ROOM
+//the requested distance apart, it is built again from another stream
+//of the same seed, keeping the first that qualifies. Returns -1
+//(having reported it, and written nothing) if none of them does.
+int generateMaze(Options* opts, uint32_t index, int dirFd){
 	
-	fprintf(roomFiles[0], "ROOM TYPE: START_ROOM");
-	fprintf(roomFiles[1], "ROOM TYPE: END_ROOM");
+	Rng rng;
+	Maze maze;
+	uint64_t start = stats.enabled ? nowNs() : 0;
+	uint32_t tries;
+	for(tries = 0; ; tries++){
+		//The try goes above the (32 bit) index, so the first try is
+		//the plain (seed, index) stream and no retry repeats the stream
+		//of another maze of the same seed.
+		seedRng(&rng, opts->seed, index | (uint64_t)tries << 32);
+		maze.numRooms = opts->numRooms;
+		nameRooms(&maze, &rng);
+		buildConnections(&maze, opts->minDegree, opts->maxDegree, &rng);
+		//The first two rooms named are the START_ROOM and END_ROOM,
+		//unless the path between them must be a given length. Either
+		//way they are chosen before the rooms are numbered from the
+		//START_ROOM.
+		maze.startRoom = 0;
+		maze.endRoom = 1;
+		if((opts->minDistance == 0 && opts->maxDistance == UINT32_MAX) ||
+		   chooseEnds(&maze, opts->minDistance > 0 ? opts->minDistance : 1, 
+				opts->maxDistance, &rng)){
+			break;
+		}
+		freeMaze(&maze);
+		if(tries + 1 == MAX_MAZE_TRIES){
+			fprintf(stderr, "Maze %u: no START_ROOM found with an END_ROOM %s steps away "
+				"(in %d mazes of %d tries)\n", index, distanceRange(opts), 
+				MAX_MAZE_TRIES, MAX_START_TRIES);
+			return -1;
+		}
+	}
+	orderRooms(&maze);
+	uint64_t built = stats.enabled ? nowNs() : 0;
+	if(opts->binary){
+		writeMazeFile(&maze, dirFd);
+	}
+	else{
+		writeRooms(&maze, dirFd);
+	}
+	if(stats.enabled){
+		countStat(&stats.generateNs, built - start);
+		countStat(&stats.writeNs, nowNs() - built);
+		countStat(&stats.mazes, 1);
+		countStat(&stats.rooms, maze.numRooms);
+		countStat(&stats.connections, maze.offsets[maze.numRooms] / 2);
+	}
+	freeMaze(&maze);
+	return 0;
+}
+
+//Function run by each pool thread: claim the next maze index and
+//generate that maze into its own subdirectory, until none are left
+//or a maze could not be generated.
+void* poolWorker(void* arg){
 	
+	Pool* p = arg;
+	uint32_t index;
+	while(!__atomic_load_n(&p->failed, __ATOMIC_RELAXED) &&
+	      (index = __atomic_fetch_add(&p->nextMaze, 1, __ATOMIC_RELAXED)) < p->opts->count){
+		char dirName[24];
+		snprintf(dirName, sizeof(dirName), "maze.%u", index);
+		int dirFd;
+		if(mkdirat(p->poolFd, dirName, 0755) != 0 ||
+		   (dirFd = openat(p->poolFd, dirName, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1){
+			perror("Maze directory could not be created.");
+			exit(EXIT_FAILURE);
+		}
+		if(generateMaze(p->opts, index, dirFd) == -1){
+			__atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+		}
+		close(dirFd);
+	}
+	return NULL;
+}
+
+//Function to generate opts->count mazes into poolDir on
+//opts->numThreads threads. Returns -1 if a maze could not be
+//generated; the other threads finish the mazes they are writing
+//and start no more.
+int generatePool(Options* opts, char* poolDir){
+	
+	Pool p;
+	p.opts = opts;
+	p.nextMaze = 0;
+	p.failed = 0;
+	if((p.poolFd = open(poolDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1){
+		perror(poolDir);
+		exit(EXIT_FAILURE);
+	}
+
+	int numThreads = opts->numThreads;
+	if((uint32_t)numThreads > opts->count){
+		numThreads = (int)opts->count;
+	}
+	pthread_t* tids;
+	if((tids = malloc(numThreads * sizeof(pthread_t))) == NULL){
+		perror("Error allocating memory for pool threads");
+		exit(EXIT_FAILURE);
+	}
 	int i;
-	for(i = 2; i < 7; i++){
-		fprintf(roomFiles[i], "ROOM TYPE: MID_ROOM");
+	for(i = 1; i < numThreads; i++){
+		if((pthread_create(&tids[i], NULL, poolWorker, &p)) != 0){
+			perror("Error creating thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	poolWorker(&p);
+	for(i = 1; i < numThreads; i++){
+		pthread_join(tids[i], NULL);
 	}
+	free(tids);
+	close(p.poolFd);
+	return p.failed ? -1 : 0;
 }
 
 int main(int argc, char* argv[]){
 	
-	//Seed the random number generator
-	srand(time(NULL));
+	uint64_t start = nowNs();
+	Options opts;
+	parseOptions(argc, argv, &opts);
+
+	//Open the stats file now, before changing directory.
+	FILE* statsOut = stderr;
+	if(opts.statsFile != NULL && (statsOut = fopen(opts.statsFile, "w")) == NULL){
+		perror(opts.statsFile);
+		exit(EXIT_FAILURE);
+	}
+
+	//Seed the random number generator (used by classic mode)
+	srand((unsigned int)mix64(opts.seed));
+
+	//Pool mode: the mazes go in their own directory, which the
+	//game's search for rooms directories never matches.
+	if(opts.count > 0){
+		char poolDir[32];
+		snprintf(poolDir, sizeof(poolDir), "fridkisb.pool.%d", (int)getpid());
+		if(mkdir(poolDir, 0755) != 0){
+			perror("Pool directory could not be created.");
+			exit(EXIT_FAILURE);
+		}
+		if(generatePool(&opts, poolDir) == -1){
+			fprintf(stderr, "%s is incomplete.\n", poolDir);
+			exit(EXIT_FAILURE);
+		}
+		printf("%s: %u mazes (seed %lu)\n", poolDir, opts.count, opts.seed);
+		if(stats.enabled){
+			printStats(statsOut, nowNs() - start);
+		}
+		return 0;
+	}
+
+	//Stream mode: the maze file goes to standard output, and no
+	//directory or manifest is written.
+	if(opts.toStdout){
+		if(generateMaze(&opts, 0, -1) == -1){
+			exit(EXIT_FAILURE);
+		}
+		if(stats.enabled){
+			printStats(statsOut, nowNs() - start);
+		}
+		return 0;
+	}
 
 	//Establish directory name string, with extra 5 bytes
 	//for process id.
@@ -183,6 +1431,20 @@ int main(int argc, char* argv[]){
 		exit(EXIT_FAILURE);
 	}
 
+	//Generator mode: build the maze in memory, then write it out.
+	//This is the same maze as maze.0 of a pool with the same seed.
+	if(opts.numRooms > 0){
+		chdir(roomsDir);
+		if(generateMaze(&opts, 0, AT_FDCWD) == -1){
+			exit(EXIT_FAILURE);
+		}
+		writeManifest(roomsDir, &opts, opts.numRooms);
+		if(stats.enabled){
+			printStats(statsOut, nowNs() - start);
+		}
+		return 0;
+	}
+
 	//Create an array of 10 strings, 11 characters each.
 	//These will store the names of the 10 filenames that
 	//will potentially store the room data, each
@@ -225,17 +1487,37 @@ int main(int argc, char* argv[]){
 	strcpy(roomNames[8], "RAW_SUGA");
 	strcpy(roomNames[9], "SUCROSE");
 
+	uint64_t built = nowNs();
 	int* roomAssignment = pickRooms();
 
 	//Change directory to roomsDir
 	chdir(roomsDir);
 
-	//Create room files and pass pointer to open handlers
-	FILE** roomFiles = createRooms(roomFileNames, roomNames, roomAssignment);
+	//Build the contents of the room files in memory
+	RoomText rooms[7];
+	memset(rooms, 0, sizeof(rooms));
+	createRooms(roomNames, roomAssignment, rooms);
 	//Load room connections
-	loadConnections(roomNames, roomAssignment, roomFiles);
-	//Assign room types
-	assignRT(roomFiles);
+	char linked[7][7];
+	memset(linked, 0, sizeof(linked));
+	loadConnections(roomNames, roomAssignment, rooms, linked);
+	//Assign room types: the first two rooms are the START_ROOM and
+	//END_ROOM, unless the path between them must be a given length.
+	int startRoom = 0, endRoom = 1;
+	if((opts.minDistance > 0 || opts.maxDistance < UINT32_MAX) &&
+	   !chooseClassicEnds(linked, opts.minDistance, opts.maxDistance, &startRoom, &endRoom)){
+		fprintf(stderr, "No rooms are %s steps apart\n", distanceRange(&opts));
+		exit(EXIT_FAILURE);
+	}
+	assignRT(rooms, startRoom, endRoom);
+
+	//Write each room file whole
+	uint64_t writing = nowNs();
+	for(i = 0; i < 7; i++){
+		writeRoomFile(AT_FDCWD, roomFileNames[roomAssignment[i]], &rooms[i]);
+		free(rooms[i].data);
+	}
+	uint64_t written = nowNs();
 
 	//Free memory
 	for(i = 0; i < 10; i++){
@@ -243,9 +1525,14 @@ int main(int argc, char* argv[]){
 		free(roomNames[i]);
 	}
 
-	//Close files
-	for(i = 0; i < 7; i++){
-		fclose(roomFiles[i]);
+	//Point the game at the new rooms
+	writeManifest(roomsDir, &opts, 7);
+	if(stats.enabled){
+		stats.generateNs = writing - built;
+		stats.writeNs = written - writing;
+		stats.mazes = 1;
+		stats.rooms = 7;
+		printStats(statsOut, nowNs() - start);
 	}
 
 	return 0;
@@ -260,5 +1547,10 @@ int main(int argc, char* argv[]){
  * https://en.cppreference.com/w/c/io/fread
  * https://stackoverflow.com/questions/12784766/check-substring-exists-in-a-string-in-c
  * https://gist.github.com/lesovsky/d32a984f97cfcb991c54b27b5d6d3e0d
+ * https://en.wikipedia.org/wiki/Sparse_matrix#Compressed_sparse_row_(CSR,_CRS_or_Yale_format)
+ * https://prng.di.unimi.it/splitmix64.c
+ * https://prng.di.unimi.it/xoshiro256starstar.c
+ * https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+ * https://en.wikipedia.org/wiki/Disjoint-set_data_structure
  * "C Programming Language". Kernighan, Brian and Dennis Ritchie. 2nd Edition. Pearson Education, Inc. 1988.
 *************************************************************************************************************/
@@ -0,0 +1,291 @@
+/****************************************************************************
+** Program name: fridkisb.loadgen.c
+** Class name: CS344
+** Author: Ben Fridkis
+** Description: This program is a load generator for the game server
+**				(fridkisb.adventure --server <socket>). It opens many
+**				concurrent sessions on the server's Unix domain socket,
+**				and in each one plays random moves (picked from the
+**				"POSSIBLE CONNECTIONS" of every prompt) until the END_ROOM
+**				is found or the move limit is reached. All sessions are
+**				driven from one thread with a nonblocking epoll loop.
+**				When every session has finished, the number of moves,
+**				moves per second and per-move latency (from sending a move
+**				to receiving the next prompt) are printed.
+****************************************************************************/
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+//The server ends every prompt with this.
+#define PROMPT "WHERE TO >"
+
+//State of one client session.
+typedef struct {
+	int fd;
+	char* response;				//Server output since the last move
+	size_t used;
+	size_t size;
+	int moves;					//Moves sent so far
+	double sentAt;				//When the last move was sent
+} Client;
+
+//Function to return the current time of the monotonic clock in seconds.
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Function to print usage information and exit.
+void usage(char* prog){
+	fprintf(stderr, "Usage: %s <socket> [--sessions N] [--moves M] [--seed S]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+//Comparison function for sorting latencies.
+int compareTimes(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+//Function to connect a new session to the server.
+int connectClient(const char* socketPath){
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+
+	int fd;
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1){
+		perror("Error creating socket");
+		exit(EXIT_FAILURE);
+	}
+	//Retry while the server's accept backlog is full.
+	while(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1){
+		if(errno != EAGAIN){
+			perror(socketPath);
+			exit(EXIT_FAILURE);
+		}
+		usleep(1000);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+//Function to pick a random connection from the last prompt in the
+//client's response and send it. Returns -1 if that fails.
+int sendMove(Client* c){
+
+	char* line = NULL;
+	char* p = c->response;
+	char* found;
+	while((found = strstr(p, "POSSIBLE CONNECTIONS: ")) != NULL){
+		line = found + strlen("POSSIBLE CONNECTIONS: ");
+		p = line;
+	}
+	if(line == NULL){
+		return -1;
+	}
+
+	//Connections are separated by spaces, and the last ends with ".\n".
+	char* end = strchr(line, '\n');
+	if(end == NULL || end == line){
+		return -1;
+	}
+	int count = 1;
+	for(p = line; p < end; p++){
+		if(*p == ' '){
+			count++;
+		}
+	}
+	int pick = rand() % count;
+	for(p = line; pick > 0; p++){
+		if(*p == ' '){
+			pick--;
+		}
+	}
+	char* stop = p;
+	while(stop < end && *stop != ' ' && *stop != '.'){
+		stop++;
+	}
+
+	char move[256];
+	int len = snprintf(move, sizeof(move), "%.*s\n", (int)(stop - p), p);
+	if(len <= 1 || len >= (int)sizeof(move) ||
+	   send(c->fd, move, len, MSG_NOSIGNAL) != len){
+		return -1;
+	}
+	c->moves++;
+	c->sentAt = now();
+	c->used = 0;
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+
+	if(argc < 2 || argv[1][0] == '-'){
+		usage(argv[0]);
+	}
+	char* socketPath = argv[1];
+	long numSessions = 100;
+	long maxMoves = 100;
+	unsigned long seed = (unsigned long)time(NULL);
+	int i;
+	for(i = 2; i < argc; i++){
+		if(strcmp(argv[i], "--sessions") == 0 && i + 1 < argc){
+			numSessions = atol(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--moves") == 0 && i + 1 < argc){
+			maxMoves = atol(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+			seed = strtoul(argv[++i], NULL, 10);
+		}
+		else{
+			usage(argv[0]);
+		}
+	}
+	if(numSessions < 1 || maxMoves < 1){
+		usage(argv[0]);
+	}
+	srand(seed);
+
+	//Allow as many sessions as the hard limit permits.
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	Client* clients;
+	double* latencies;
+	if((clients = calloc(numSessions, sizeof(Client))) == NULL ||
+	   (latencies = malloc(numSessions * maxMoves * sizeof(double))) == NULL){
+		perror("Error allocating memory for sessions");
+		exit(EXIT_FAILURE);
+	}
+
+	int epfd;
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+		perror("Error creating epoll instance");
+		exit(EXIT_FAILURE);
+	}
+
+	double start = now();
+	long c;
+	for(c = 0; c < numSessions; c++){
+		clients[c].fd = connectClient(socketPath);
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &clients[c];
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, clients[c].fd, &ev) == -1){
+			perror("Error adding session");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	//Read each session's responses, and move again whenever a full
+	//prompt has arrived.
+	long open = numSessions, numLatencies = 0, finished = 0, failed = 0;
+	struct epoll_event events[256];
+	while(open > 0){
+		int n = epoll_wait(epfd, events, 256, -1);
+		if(n == -1 && errno != EINTR){
+			perror("Error waiting for sessions");
+			exit(EXIT_FAILURE);
+		}
+		for(i = 0; i < n; i++){
+			Client* cl = events[i].data.ptr;
+			int closing = 0;
+			for(;;){
+				if(cl->size - cl->used < 4096){
+					cl->size = cl->size ? cl->size * 2 : 8192;
+					if((cl->response = realloc(cl->response, cl->size)) == NULL){
+						perror("Error allocating memory for response");
+						exit(EXIT_FAILURE);
+					}
+				}
+				ssize_t r = recv(cl->fd, cl->response + cl->used, cl->size - cl->used - 1, 0);
+				if(r > 0){
+					cl->used += r;
+					continue;
+				}
+				if(r == 0){
+					//The server closes the session once the END_ROOM is found.
+					finished++;
+					closing = 1;
+				}
+				else if(errno != EAGAIN && errno != EWOULDBLOCK){
+					failed++;
+					closing = 1;
+				}
+				break;
+			}
+			cl->response[cl->used] = '\0';
+
+			size_t len = strlen(PROMPT);
+			if(!closing && cl->used >= len &&
+			   memcmp(cl->response + cl->used - len, PROMPT, len) == 0){
+				if(cl->moves > 0){
+					latencies[numLatencies++] = now() - cl->sentAt;
+				}
+				if(cl->moves == maxMoves){
+					closing = 1;
+				}
+				else if(sendMove(cl) == -1){
+					failed++;
+					closing = 1;
+				}
+			}
+			if(closing){
+				close(cl->fd);
+				free(cl->response);
+				cl->response = NULL;
+				open--;
+			}
+		}
+	}
+	double elapsed = now() - start;
+
+	long moves = 0;
+	for(c = 0; c < numSessions; c++){
+		moves += clients[c].moves;
+	}
+	printf("Sessions: %ld (%ld found the END_ROOM, %ld failed)\n", numSessions, finished, failed);
+	printf("Moves: %ld in %.3f s (%.0f moves/s)\n", moves, elapsed, moves / elapsed);
+	if(numLatencies > 0){
+		qsort(latencies, numLatencies, sizeof(double), compareTimes);
+		double total = 0;
+		long k;
+		for(k = 0; k < numLatencies; k++){
+			total += latencies[k];
+		}
+		printf("Latency: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			total / numLatencies * 1e6, latencies[numLatencies / 2] * 1e6,
+			latencies[numLatencies * 99 / 100] * 1e6, latencies[numLatencies - 1] * 1e6);
+	}
+
+	close(epfd);
+	free(clients);
+	free(latencies);
+	return failed > 0 ? EXIT_FAILURE : 0;
+}
+
+/************************************************************************************************************
+ * References *
+ * https://man7.org/linux/man-pages/man7/epoll.7.html
+ * https://man7.org/linux/man-pages/man7/unix.7.html
+************************************************************************************************************/
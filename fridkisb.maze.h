@@ -0,0 +1,77 @@
+/****************************************************************************
+** File name: fridkisb.maze.h
+** Class name: CS344
+** Author: Ben Fridkis
+** Description: Layout of the binary maze file ("maze.bin") written by
+**				fridkisb.buildrooms --binary and memory-mapped by
+**				fridkisb.adventure. The file is used in place, so every
+**				section is aligned to 8 bytes and stored in the byte order
+**				of the machine that generated it:
+**
+**				MazeHeader
+**				name index		numRooms x uint32_t (offsets into string table)
+**				adjacency index	(numRooms + 1) x uint32_t (offsets into adjacency)
+**				adjacency array	numTargets x uint32_t (room IDs)
+**				string table	null-terminated room names
+**
+**				The connections of room i are adjacency[index[i]] through
+**				adjacency[index[i + 1] - 1].
+**
+**				A maze can also be compiled into the game (see
+**				fridkisb.adventure --compile), as const arrays with the
+**				same layout described by a BuiltinMaze.
+****************************************************************************/
+
+#ifndef FRIDKISB_MAZE_H
+#define FRIDKISB_MAZE_H
+
+#include <stdint.h>
+
+#define MAZE_MAGIC "FRDKMAZE"
+#define MAZE_VERSION 1
+#define MAZE_FILE_NAME "maze.bin"
+
+//Manifest naming the newest rooms directory, rewritten atomically
+//(write then rename) by fridkisb.buildrooms after every maze. The
+//first line is the directory name; the rest are "key value" lines
+//describing the maze (rooms, seed, format, created).
+#define LATEST_FILE_NAME "fridkisb.latest"
+
+//Round a section size up to the next multiple of 8 bytes.
+#define MAZE_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+typedef struct {
+	char magic[8];				//MAZE_MAGIC (not null-terminated)
+	uint32_t version;			//MAZE_VERSION
+	uint32_t numRooms;
+	uint32_t numTargets;		//Total (directed) connections
+	uint32_t startRoom;			//ID of the START_ROOM
+	uint32_t endRoom;			//ID of the END_ROOM
+	uint32_t stringsSize;		//Bytes used by the string table
+	uint64_t nameIndexOffset;	//Byte offsets of each section from
+	uint64_t adjIndexOffset;	//the start of the file
+	uint64_t adjOffset;
+	uint64_t stringsOffset;
+	uint64_t fileSize;
+} MazeHeader;
+
+//Maze compiled into fridkisb.adventure. The arrays match the sections
+//of a maze file, and the name lookup table is the game's perfect hash
+//index (hash seed, bucket displacements and slots) as it would be
+//built at startup.
+typedef struct {
+	uint32_t numRooms;
+	uint32_t startRoom;
+	uint32_t endRoom;
+	const uint32_t* nameIndex;
+	const uint32_t* adjIndex;
+	const uint32_t* adj;
+	const char* strings;
+	uint64_t hashSeed;
+	uint32_t numBuckets;
+	uint32_t numSlots;
+	const uint32_t* displace;
+	const uint32_t* slots;
+} BuiltinMaze;
+
+#endif